@@ -9,40 +9,565 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 */
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <cerrno>
+#include <climits>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 #include <exception>
 #include <fcntl.h>
+#include <filesystem>
+#include <fstream>
 #include <getopt.h>
+#include <iomanip>
 #include <iostream>
+#include <limits>
 #include <linux/input.h>
+#include <linux/uinput.h>
+#include <map>
+#include <netinet/in.h>
+#include <mutex>
+#include <new>
+#include <numeric>
 #include <optional>
 #include <random>
 #include <sstream>
+#include <stdexcept>
 #include <stdlib.h>
 #include <string>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
 #include <thread>
+#include <type_traits>
 #include <unistd.h>
 #include <vector>
 
+#ifdef NO_WIRINGPI
+// Analysis-only build for machines without wiringPi. The measurement
+// commands are refused in parse_args, so these are never called.
+#define INPUT 0
+#define OUTPUT 1
+#define LOW 0
+#define HIGH 1
+#define PUD_UP 2
+
+inline int wiringPiSetup() { return -1; }
+inline void pinMode(int, int) {}
+inline void pullUpDnControl(int, int) {}
+inline void digitalWrite(int, int) {}
+inline int digitalRead(int) { return HIGH; }
+#else
 #include <wiringPi.h>
+#endif
+
+// USDT probes for bpftrace and perf, e.g. usdt:./measure-input-latency:
+// measure_input_latency:trial_start. Each is a nop until a tracer attaches,
+// and nothing at all without sys/sdt.h.
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PROBE(...) STAP_PROBEV(measure_input_latency, __VA_ARGS__)
+#else
+#define PROBE(...) do {} while (0)
+#endif
 
 const int g_pin_input = 0;
 const int g_pin_output = 2;
 
+struct key_binding {
+	int pin;
+	unsigned int code;
+	std::optional<int> row = {};
+	std::optional<int> col = {};
+	// Evdev device reporting the key: 0 is --usb, 1 is the --ab device.
+	int device = 0;
+};
+
+struct sequence_step {
+	enum class kind { write, wait, sync };
+
+	kind type;
+	std::vector<std::size_t> keys = {};
+	bool pressed = false;
+	std::chrono::microseconds duration = {};
+};
+
+struct pulse_result {
+	std::chrono::nanoseconds width;
+	std::chrono::nanoseconds actual;
+	int detected;
+	int reps;
+};
+
+struct idle_result {
+	std::chrono::milliseconds idle;
+	std::optional<std::chrono::nanoseconds> time;
+};
+
+class Arena {
+	public:
+
+	// One anonymous mapping, prefaulted so that no page faults land inside a
+	// trial. With `huge`, explicit huge pages are tried first, then
+	// transparent huge pages.
+	Arena(std::size_t bytes = 0, const bool huge = false) {
+		if (bytes == 0) {
+			return;
+		}
+
+		const std::size_t huge_page = 2 << 20;
+
+		if (huge) {
+			_size = (bytes + huge_page - 1) / huge_page * huge_page;
+			_data = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_HUGETLB, -1, 0);
+		}
+
+		if (!huge) {
+			_size = bytes;
+			_data = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+		} else if (_data == MAP_FAILED) {
+			// MAP_POPULATE would fault in small pages before the advice
+			// could take effect, so advise first and touch afterwards.
+			_data = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+			if (_data != MAP_FAILED) {
+				madvise(_data, _size, MADV_HUGEPAGE);
+				for (std::size_t i = 0; i < _size; i += 4096) {
+					static_cast<volatile char*>(_data)[i] = 0;
+				}
+			}
+		}
+
+		if (_data == MAP_FAILED) {
+			throw std::bad_alloc();
+		}
+	}
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	Arena(Arena&& other) {
+		*this = std::move(other);
+	}
+
+	Arena& operator=(Arena&& other) {
+		std::swap(_data, other._data);
+		std::swap(_size, other._size);
+		return *this;
+	}
+
+	~Arena() {
+		if (_data != MAP_FAILED) {
+			munmap(_data, _size);
+		}
+	}
+
+	char* data() const {
+		return static_cast<char*>(_data);
+	}
+
+	// Columns start on a cache line.
+	template <typename T>
+	static std::size_t bytes(const std::size_t n) {
+		return (n * sizeof(T) + 63) / 64 * 64;
+	}
+
+	private:
+	void* _data = MAP_FAILED;
+	std::size_t _size = 0;
+};
+
+template <typename T>
+class Column {
+	public:
+
+	Column() = default;
+	Column(T* data, const std::size_t size) : _data(data), _size(size) {}
+
+	T& operator[](const std::size_t i) const {
+		return _data[i];
+	}
+
+	T* begin() const {
+		return _data;
+	}
+
+	T* end() const {
+		return _data + _size;
+	}
+
+	T& front() const {
+		return _data[0];
+	}
+
+	T& back() const {
+		return _data[_size - 1];
+	}
+
+	std::size_t size() const {
+		return _size;
+	}
+
+	private:
+	T* _data = nullptr;
+	std::size_t _size = 0;
+};
+
+namespace trial_flags {
+	// `kernel` holds the evdev timestamp of the press.
+	const std::uint32_t kernel_time = 1 << 0;
+}
+
+// One column per field, so analysis can stream over a single field. All
+// columns live in one arena sized before the first trial.
+class trial_records {
+	public:
+
+	Column<std::uint32_t> key;
+	Column<std::uint32_t> flags;
+	// Press latency.
+	Column<std::chrono::nanoseconds> time;
+	// Release latency.
+	Column<std::chrono::nanoseconds> released;
+	// Delay from the schedule, and how long the sleep actually took.
+	Column<std::chrono::nanoseconds> planned;
+	Column<std::chrono::nanoseconds> slept;
+	// Press and release write times on the high resolution clock.
+	Column<std::chrono::nanoseconds> press;
+	Column<std::chrono::nanoseconds> release;
+	// Kernel timestamp of the press event, on the same clock.
+	Column<std::chrono::nanoseconds> kernel;
+	// Detector polls until the press was seen.
+	Column<std::uint32_t> polls;
+
+	// Owns its columns.
+	trial_records(const std::size_t n = 0, const bool huge = false) : _arena(bytes(n), huge), _size(n) {
+		layout(_arena.data());
+	}
+
+	// Lays the columns out over `data`, which must hold bytes(n).
+	trial_records(char* data, const std::size_t n) : _size(n) {
+		layout(data);
+	}
+
+	static std::size_t bytes(const std::size_t n) {
+		return 3 * Arena::bytes<std::uint32_t>(n) + 7 * Arena::bytes<std::chrono::nanoseconds>(n);
+	}
+
+	std::size_t size() const {
+		return _size;
+	}
+
+	// Calls f on every column, in layout order.
+	template <typename F>
+	void each_column(F f) const {
+		f(key);
+		f(flags);
+		f(time);
+		f(released);
+		f(planned);
+		f(slept);
+		f(press);
+		f(release);
+		f(kernel);
+		f(polls);
+	}
+
+	// Copies n trials from `src`, starting at `from`, to `to`.
+	void copy(const trial_records& src, const std::size_t from, const std::size_t to, const std::size_t n) {
+		std::copy_n(src.key.begin() + from, n, key.begin() + to);
+		std::copy_n(src.flags.begin() + from, n, flags.begin() + to);
+		std::copy_n(src.time.begin() + from, n, time.begin() + to);
+		std::copy_n(src.released.begin() + from, n, released.begin() + to);
+		std::copy_n(src.planned.begin() + from, n, planned.begin() + to);
+		std::copy_n(src.slept.begin() + from, n, slept.begin() + to);
+		std::copy_n(src.press.begin() + from, n, press.begin() + to);
+		std::copy_n(src.release.begin() + from, n, release.begin() + to);
+		std::copy_n(src.kernel.begin() + from, n, kernel.begin() + to);
+		std::copy_n(src.polls.begin() + from, n, polls.begin() + to);
+	}
+
+	private:
+	void layout(char* data) {
+		std::size_t offset = 0;
+
+		key = column<std::uint32_t>(data, offset);
+		flags = column<std::uint32_t>(data, offset);
+		time = column<std::chrono::nanoseconds>(data, offset);
+		released = column<std::chrono::nanoseconds>(data, offset);
+		planned = column<std::chrono::nanoseconds>(data, offset);
+		slept = column<std::chrono::nanoseconds>(data, offset);
+		press = column<std::chrono::nanoseconds>(data, offset);
+		release = column<std::chrono::nanoseconds>(data, offset);
+		kernel = column<std::chrono::nanoseconds>(data, offset);
+		polls = column<std::uint32_t>(data, offset);
+	}
+
+	template <typename T>
+	Column<T> column(char* data, std::size_t& offset) {
+		Column<T> ret(reinterpret_cast<T*>(data + offset), _size);
+		offset += Arena::bytes<T>(_size);
+		return ret;
+	}
+
+	Arena _arena;
+	std::size_t _size;
+};
+
+struct summary {
+	std::size_t count = 0;
+	std::chrono::nanoseconds min = {};
+	std::chrono::nanoseconds median = {};
+	std::chrono::nanoseconds p90 = {};
+	std::chrono::nanoseconds p99 = {};
+	std::chrono::nanoseconds max = {};
+	double mean = 0;
+};
+
+summary summarize(std::vector<std::chrono::nanoseconds> times) {
+	summary ret;
+
+	if (times.empty()) {
+		return ret;
+	}
+
+	std::sort(std::begin(times), std::end(times));
+
+	// Nearest-rank percentiles; good enough for the sample counts we run.
+	const auto rank = [&](const double p) {
+		return times[std::min(times.size() - 1, static_cast<std::size_t>(p * times.size()))];
+	};
+
+	ret.count = times.size();
+	ret.min = times.front();
+	ret.median = rank(0.5);
+	ret.p90 = rank(0.9);
+	ret.p99 = rank(0.99);
+	ret.max = times.back();
+
+	for (const auto& t : times) {
+		ret.mean += static_cast<double>(t.count()) / times.size();
+	}
+
+	return ret;
+}
+
+std::string summary_json(const summary& s) {
+	std::stringstream ss;
+	ss << "\"count\":" << s.count << ","
+	   << "\"min\":" << s.min.count() << ","
+	   << "\"median\":" << s.median.count() << ","
+	   << "\"p90\":" << s.p90.count() << ","
+	   << "\"p99\":" << s.p99.count() << ","
+	   << "\"max\":" << s.max.count() << ","
+	   << "\"mean\":" << static_cast<long long>(s.mean);
+
+	return ss.str();
+}
+
+// Summary of a stream of latencies in constant memory. Count, min, max and
+// mean are exact; quantiles come from log spaced bins, 64 per octave, so
+// they're within about 1% of summarize().
+class RunningSummary {
+	public:
+
+	void add(const std::chrono::nanoseconds t) {
+		++_counts[bin(t)];
+		_min = _count ? std::min(_min, t) : t;
+		_max = _count ? std::max(_max, t) : t;
+		_sum += t.count();
+		++_count;
+	}
+
+	std::size_t count() const {
+		return _count;
+	}
+
+	// The rank-th smallest latency (from 0), at the middle of its bin.
+	std::chrono::nanoseconds at(const std::size_t rank) const {
+		std::size_t seen = 0;
+		std::size_t b = 0;
+		while (seen + _counts[b] <= rank) {
+			seen += _counts[b++];
+		}
+
+		const auto mid = std::chrono::nanoseconds(static_cast<long long>(std::exp2((b + 0.5) / bins_per_octave)));
+		return std::clamp(mid, _min, _max);
+	}
+
+	summary get() const {
+		summary ret;
+
+		if (_count == 0) {
+			return ret;
+		}
+
+		// Same nearest ranks as summarize().
+		const auto rank = [&](const double p) {
+			return at(std::min(_count - 1, static_cast<std::size_t>(p * _count)));
+		};
+
+		ret.count = _count;
+		ret.min = _min;
+		ret.median = rank(0.5);
+		ret.p90 = rank(0.9);
+		ret.p99 = rank(0.99);
+		ret.max = _max;
+		ret.mean = _sum / _count;
+
+		return ret;
+	}
+
+	private:
+	static constexpr int bins_per_octave = 64;
+	static constexpr std::size_t bins = bins_per_octave * 48;
+
+	static std::size_t bin(const std::chrono::nanoseconds t) {
+		const double ns = std::max(1.0, static_cast<double>(t.count()));
+		return std::min(bins - 1, static_cast<std::size_t>(std::log2(ns) * bins_per_octave));
+	}
+
+	std::array<std::uint64_t, bins> _counts = {};
+	std::size_t _count = 0;
+	std::chrono::nanoseconds _min = {};
+	std::chrono::nanoseconds _max = {};
+	double _sum = 0;
+};
+
+std::string json_string(const std::string& s) {
+	std::string ret = "\"";
+
+	for (const auto c : s) {
+		if (c == '"' || c == '\\') {
+			ret += '\\';
+			ret += c;
+		} else if (static_cast<unsigned char>(c) < 0x20) {
+			ret += ' ';
+		} else {
+			ret += c;
+		}
+	}
+
+	return ret + "\"";
+}
+
+struct load_spec {
+	std::string text;
+	std::string kind;
+	int threads = 1;
+	int intensity = 100;
+	std::vector<int> cpus = {};
+};
+
 struct program_config {
 	int iterations = 1000;
 	int delay_min = 10000;
 	int delay_max = 20000;
 	bool pin = false;
+	bool uinput = false;
 	std::optional<unsigned int> usb = {};
 	std::optional<unsigned int> key = {};
+	std::optional<std::string> keymap = {};
+	std::vector<key_binding> keys = {};
+	std::optional<std::string> ab = {};
+	std::optional<int> ab_event = {};
+	std::optional<std::string> sequence = {};
+	std::vector<sequence_step> steps = {};
+	int timeout = 100000;
+	std::optional<std::string> pulse = {};
+	std::chrono::nanoseconds pulse_min = {};
+	std::chrono::nanoseconds pulse_max = {};
+	std::chrono::nanoseconds pulse_resolution = std::chrono::nanoseconds(100);
+	std::optional<std::string> idle = {};
+	std::vector<std::chrono::milliseconds> idle_steps = {};
+	std::optional<bool> autosuspend = {};
+	std::optional<std::string> warmup = {};
+	bool warmup_auto = false;
+	int warmup_count = 0;
+	std::optional<int> drift = {};
+	double drift_arl = 1e7;
+	bool records = false;
+	std::optional<std::string> phase = {};
+	std::chrono::nanoseconds phase_min = {};
+	std::chrono::nanoseconds phase_max = {};
+	std::chrono::nanoseconds phase_step = {};
+	bool hugepages = false;
+	std::optional<std::string> store = {};
 	bool events = false;
+	std::optional<std::string> fit = {};
+	std::optional<std::string> pack = {};
+	std::optional<std::string> bench_codec = {};
+	std::vector<std::string> analyze = {};
+	std::optional<std::string> batch_analyze = {};
+	std::optional<std::string> baseline = {};
+	std::optional<std::string> candidate = {};
+	double gate_threshold = 5;
+	double gate_confidence = 0.95;
+	std::string catalog = "";
+	std::optional<std::string> query = {};
+	std::optional<std::string> daemon = {};
+	std::optional<int> metrics = {};
+	std::optional<std::string> feed = {};
+	std::optional<std::string> tail = {};
+	std::optional<std::string> flight = {};
+	std::optional<std::string> trace = {};
+	bool tracefs = false;
+	std::optional<int> cpu = {};
+	std::optional<int> priority = {};
+	int jitter = 0;
+	std::optional<std::chrono::nanoseconds> max_jitter = {};
+	std::vector<load_spec> load = {};
+	std::chrono::nanoseconds flight_threshold = {};
+	std::string flight_dir = ".";
 	bool summary = false;
 };
 
 program_config config;
 
-void print_config() {
+// Timer wakeup lateness on the trial loop's CPU and priority, before and
+// during the run (--jitter).
+std::optional<summary> g_jitter_before;
+std::optional<summary> g_jitter_during;
+
+// Work units per second each --load achieved during the run.
+std::vector<double> g_load_rates;
+
+// Steady-state latencies of a --store run, kept as they're written so the
+// catalog doesn't have to read the store back. Auto warm-up detection needs
+// the whole run, so this leaves out the fixed --warmup count. Indexed by
+// key_binding::device.
+RunningSummary g_store_summary[2];
+
+// Whether the keys include the --ab device, in a run or a loaded archive.
+bool has_ab_keys() {
+	return std::any_of(std::begin(config.keys), std::end(config.keys), [](const auto& k) { return k.device != 0; });
+}
+
+// Only keymaps put more than one key on a device, also in analyzed archives.
+bool has_keymap_keys() {
+	for (const int device : { 0, 1 }) {
+		if (std::count_if(std::begin(config.keys), std::end(config.keys), [&](const auto& k) { return k.device == device; }) > 1) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+std::string config_json() {
 	const auto tf = [](bool a) { return a ? "true" : "false"; };
 
 	const auto opt = [](std::optional<int> a) {
@@ -57,12 +582,52 @@ void print_config() {
 		return ss.str();
 	};
 
-	std::cout << "{\"iterations\":" << config.iterations << ","
-	          << "\"delay_min\":" << config.delay_min << ","
-	          << "\"delay_max\":" << config.delay_max << ","
-	          << "\"pin\":" << tf(config.pin) << ","
-	          << "\"usb\":" << opt(config.usb) << ","
-	          << "\"key\":" << opt(config.key) << "}" << std::endl;
+	const auto str = [](std::optional<std::string> a) {
+		return a ? json_string(*a) : std::string("null");
+	};
+
+	std::stringstream ss;
+	ss << "{\"iterations\":" << config.iterations << ","
+	   << "\"delay_min\":" << config.delay_min << ","
+	   << "\"delay_max\":" << config.delay_max << ","
+	   << "\"pin\":" << tf(config.pin) << ","
+	   << "\"uinput\":" << tf(config.uinput) << ","
+	   << "\"usb\":" << opt(config.usb) << ","
+	   << "\"key\":" << opt(config.key) << ","
+	   << "\"keymap\":" << str(config.keymap) << ","
+	   << "\"sequence\":" << str(config.sequence) << ","
+	   << "\"timeout\":" << config.timeout << ","
+	   << "\"pulse\":" << str(config.pulse) << ","
+	   << "\"idle\":" << str(config.idle) << ","
+	   << "\"autosuspend\":" << (config.autosuspend ? tf(*config.autosuspend) : "null") << ","
+	   << "\"warmup\":" << str(config.warmup) << ","
+	   << "\"drift\":" << opt(config.drift) << ","
+	   << "\"drift_arl\":" << config.drift_arl << ","
+	   << "\"records\":" << tf(config.records) << ","
+	   << "\"phase\":" << str(config.phase) << ","
+	   << "\"hugepages\":" << tf(config.hugepages) << ","
+	   << "\"store\":" << str(config.store) << ","
+	   << "\"ab\":" << str(config.ab) << ","
+	   << "\"metrics\":" << opt(config.metrics) << ","
+	   << "\"feed\":" << str(config.feed) << ","
+	   << "\"flight\":" << str(config.flight) << ","
+	   << "\"tracefs\":" << tf(config.tracefs) << ","
+	   << "\"cpu\":" << opt(config.cpu) << ","
+	   << "\"priority\":" << opt(config.priority) << ","
+	   << "\"jitter\":" << config.jitter << ","
+	   << "\"max_jitter\":" << (config.max_jitter ? std::to_string(config.max_jitter->count()) : "null") << ","
+	   << "\"host_jitter\":" << (g_jitter_before ? "{" + summary_json(*g_jitter_before) + "}" : "null") << ","
+	   << "\"load\":[";
+	for (std::size_t i = 0; i < config.load.size(); ++i) {
+		ss << (i ? "," : "") << str(config.load[i].text);
+	}
+	ss << "]}";
+
+	return ss.str();
+}
+
+void print_config() {
+	std::cout << config_json() << std::endl;
 }
 
 class Event {
@@ -94,6 +659,13 @@ class Event {
 		return std::string(event_name);
 	}
 
+	input_id device_id() const {
+		input_id ret = {};
+		ioctl(_fd, EVIOCGID, &ret);
+
+		return ret;
+	}
+
 	int fd() const {
 		return _fd;
 	}
@@ -108,215 +680,5317 @@ class Event {
 };
 
 void init_pins() {
-	wiringPiSetup();
+	// Loopback runs don't touch GPIO.
+	if (config.uinput) {
+		return;
+	}
+
+	// The daemon sets up once and every run it forks inherits the mapping.
+	static bool setup = false;
+	if (!setup) {
+		wiringPiSetup();
+		setup = true;
+	}
 
 	pinMode(g_pin_input, INPUT);
 	pullUpDnControl(g_pin_input, PUD_UP);
 
-	pinMode(g_pin_output, OUTPUT);
-	digitalWrite(g_pin_output, LOW);
+	for (const auto& key : config.keys) {
+		pinMode(key.pin, OUTPUT);
+		digitalWrite(key.pin, LOW);
+	}
 }
 
-std::vector<std::chrono::microseconds> get_delays() {
-	// Don't really care about real randomness, as we're only using this to get
-	// a uniform distribution.
-	std::mt19937 rand_gen(30378);
-	std::uniform_int_distribution<int> int_dist { config.delay_min, config.delay_max };
-	std::vector<std::chrono::microseconds> ret(config.iterations);
+// The CPUs the process could run on before set_realtime first pinned it.
+std::optional<cpu_set_t> g_start_cpus;
 
-	std::generate(std::begin(ret), std::end(ret), [&]() { return std::chrono::microseconds(int_dist(rand_gen)); });
+// Moves the calling thread to --cpu and --priority (SCHED_FIFO).
+void set_realtime(const std::optional<int> priority) {
+	if (config.cpu) {
+		if (!g_start_cpus) {
+			cpu_set_t start;
+			if (sched_getaffinity(0, sizeof(start), &start) == 0) {
+				g_start_cpus = start;
+			}
+		}
 
-	return ret;
-}
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(*config.cpu, &set);
 
-void print_event_paths() {
-	for (int event_id = 0; event_id < 256; ++event_id) {
-		try {
-			Event event(event_id);
-			std::cout << "[" << event.id() << "] " << event.name() << std::endl;
-		} catch (const Event::OpenException&) {
-			continue;
+		if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+			std::cerr << "Could not pin to cpu " << *config.cpu << ": " << std::strerror(errno) << std::endl;
+			exit(1);
 		}
 	}
-}
 
-template <typename F>
-std::vector<std::chrono::nanoseconds> measure_loop(F detect) {
-	if (config.summary) {
-		print_config();
+	if (priority) {
+		sched_param param = {};
+		param.sched_priority = *priority;
+
+		if (sched_setscheduler(0, SCHED_FIFO, &param) != 0) {
+			std::cerr << "Could not set priority " << *priority << ": " << std::strerror(errno) << std::endl;
+			exit(1);
+		}
 	}
+}
 
-	init_pins();
+// Moves a helper thread out of the trial's way. Threads inherit the policy
+// and pin of the thread that starts them, so without this they'd compete
+// with the trial loop at its priority on its CPU. Puts the calling thread
+// back to SCHED_OTHER, on the CPUs the process started with, less --cpu
+// unless that's all there is. Returns false if either can't be done.
+bool set_background() {
+	const sched_param param = {};
+	bool ok = sched_setscheduler(0, SCHED_OTHER, &param) == 0;
 
-	auto delays = get_delays();
+	if (g_start_cpus) {
+		auto set = *g_start_cpus;
+		if (config.cpu && CPU_COUNT(&set) > 1) {
+			CPU_CLR(*config.cpu, &set);
+		}
 
-	std::vector<std::chrono::nanoseconds> times(config.iterations);
+		ok = sched_setaffinity(0, sizeof(set), &set) == 0 && ok;
+	}
 
-	for (int i = 0; i < config.iterations; ++i) {
-		std::this_thread::sleep_for(delays[i]);
+	return ok;
+}
 
-		auto start = std::chrono::high_resolution_clock::now();
+// How late absolute-deadline sleeps wake up on the calling thread, in the
+// manner of cyclictest. Stops early once `stop` is set.
+std::vector<std::chrono::nanoseconds> measure_wakeups(const std::size_t count, const std::chrono::microseconds interval, const std::atomic<bool>* stop = nullptr) {
+	std::vector<std::chrono::nanoseconds> ret;
+	ret.reserve(std::min<std::size_t>(count, 1 << 16));
 
-		digitalWrite(g_pin_output, HIGH);
-		detect(true);
+	timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
 
-		times[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start);
+	while (ret.size() < count && !(stop && stop->load())) {
+		next.tv_nsec += std::chrono::duration_cast<std::chrono::nanoseconds>(interval).count();
+		while (next.tv_nsec >= 1000000000) {
+			next.tv_nsec -= 1000000000;
+			++next.tv_sec;
+		}
+
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
 
-		digitalWrite(g_pin_output, LOW);
-		detect(false);
+		timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ret.push_back(std::chrono::seconds(now.tv_sec - next.tv_sec) + std::chrono::nanoseconds(now.tv_nsec - next.tv_nsec));
 	}
 
-	return times;
+	return ret;
 }
 
-std::vector<std::chrono::nanoseconds> measure_usb(const int event_id) {
-	try {
-		Event event(event_id);
+class JitterProbe {
+	public:
 
-		auto fd = event.fd();
+	// Samples wakeup lateness ten times a second while the run goes on. Like
+	// the baseline, it runs on --cpu at --priority, set explicitly rather
+	// than inherited, so it sees the jitter the trial loop itself sees.
+	JitterProbe() : _thread([this]() {
+		set_realtime(config.priority);
+		_wakeups = measure_wakeups(std::numeric_limits<std::size_t>::max(), std::chrono::milliseconds(100), &_stop);
+	}) {}
 
-		return measure_loop([&](const bool pressed) {
-			while (true) {
-				input_event keyboard_event;
+	summary stop() {
+		_stop.store(true);
+		_thread.join();
+		return summarize(_wakeups);
+	}
 
-				int ret = read(fd, &keyboard_event, sizeof(input_event));
+	private:
+	std::atomic<bool> _stop { false };
+	std::vector<std::chrono::nanoseconds> _wakeups;
+	std::thread _thread;
+};
 
-				if (ret == -1) {
-					continue;
-				}
+class LoadGenerator {
+	public:
 
-				if (
-					keyboard_event.type == EV_KEY &&
-					keyboard_event.code == config.key &&
-					keyboard_event.value == pressed ? 1 : 0
-				) {
-					break;
-				}
-			}
-		});
-	} catch (const Event::OpenException&) {
-		std::cerr << "Could not open fd for " << event_id << std::endl;
-		exit(1);
-	}
-}
+	// Background load while measuring: each --load runs its threads on its
+	// CPUs, working for `intensity` percent of every 10ms and sleeping the
+	// rest. Kinds:
+	//   cpu    arithmetic spin
+	//   mem    streaming copies between two 64MB buffers
+	//   cache  random writes over 32MB, evicting the caches
+	//   disk   1MB writes with fdatasync to a file in $TMPDIR
+	//   irq    a UDP flood over loopback, raising network softirqs
+	// The threads run at normal priority, on their CPUs or off --cpu, and the
+	// constructor only returns once they all are.
+	LoadGenerator(const std::vector<load_spec>& specs) : _ops(specs.size()) {
+		_start = std::chrono::steady_clock::now();
 
-std::vector<std::chrono::nanoseconds> measure_pin() {
-	return measure_loop([&](const bool pressed) {
-		while (true) {
-			if (digitalRead(g_pin_input) == pressed ? LOW : HIGH) {
-				break;
+		for (std::size_t s = 0; s < specs.size(); ++s) {
+			for (int t = 0; t < specs[s].threads; ++t) {
+				_threads.emplace_back([this, &spec = specs[s], &ops = _ops[s]]() { run(spec, ops); });
 			}
 		}
-	});
-}
 
-template <typename F>
-void measure(F measure_fn) {
-	const auto times = measure_fn();
+		std::unique_lock<std::mutex> lock(_mutex);
+		_ready.wait(lock, [&]() { return _started == _threads.size(); });
+		lock.unlock();
 
-	std::stringstream tss;
-	for (const auto& t : times) {
-		tss << t.count() << std::endl;
+		if (_failed) {
+			stop();
+			throw std::runtime_error("could not move the load threads to normal priority and their cpus");
+		}
 	}
-	std::cout << tss.str();
-}
 
-void help(const bool err) {
-	program_config defaults;
+	~LoadGenerator() {
+		if (!_threads.empty()) {
+			stop();
+		}
+	}
 
-	std::stringstream help_msg;
-	help_msg << "-i, --iterations <n>   Number of iterations to perform (default: " << defaults.iterations << ")." << std::endl
-	         << "-d, --delaymin <n>     Minimum delay between measurements (default: " << defaults.delay_min << ")." << std::endl
-	         << "-D, --delaymax <n>     Maximum delay between measurements (default: " << defaults.delay_max << ")." << std::endl
-	         << "-p, --pin              Run pin-based measurement." << std::endl
-	         << "-u, --usb <event_id>   Run usb-based measurement. Pass an evdev event id." << std::endl
-	         << "-k, --key <event_code> Event code of the key used for measurement." << std::endl
-	         << "                       See kernel 'input-event-codes.h'." << std::endl
-	         << "-e, --events           List names of evdev events." << std::endl
-	         << "-s, --summary          Print summary of measurements." << std::endl
-	         << "-h, --help             Show help." << std::endl;
+	// Work units per second for each spec.
+	std::vector<double> stop() {
+		_stop.store(true);
+		for (auto& t : _threads) {
+			t.join();
+		}
+		_threads.clear();
 
-	if (err) {
-		std::cerr << help_msg.str();
-		exit(1);
-	} else {
-		std::cout << help_msg.str();
-		exit(0);
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - _start;
+		std::vector<double> ret;
+		for (const auto& ops : _ops) {
+			ret.push_back(ops.load() / elapsed.count());
+		}
+
+		return ret;
 	}
-}
 
-void parse_args(int argc, char** argv) {
-	const char* const optstring = "i:d:D:pu:k:esh";
-	const option longopts[] = {
-		{"iterations", required_argument, nullptr, 'i'},
-		{"delaymin", required_argument, nullptr, 'd'},
-		{"delaymax", required_argument, nullptr, 'D'},
-		{"pin", no_argument, nullptr, 'p'},
-		{"usb", required_argument, nullptr, 'u'},
+	private:
+	void run(const load_spec& spec, std::atomic<std::uint64_t>& ops) {
+		// Inherited from the trial thread, a full-duty load would starve it.
+		bool ok = set_background();
+
+		if (!spec.cpus.empty()) {
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			for (const auto cpu : spec.cpus) {
+				CPU_SET(cpu, &set);
+			}
+			ok = sched_setaffinity(0, sizeof(set), &set) == 0 && ok;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_failed = _failed || !ok;
+			++_started;
+		}
+		_ready.notify_one();
+
+		if (!ok) {
+			return;
+		}
+
+		const std::size_t mb = 1 << 20;
+		std::vector<char> a, b;
+		int fd = -1, rx = -1, tx = -1;
+		sockaddr_in addr = {};
+
+		if (spec.kind == "mem") {
+			a.assign(64 * mb, 1);
+			b.assign(64 * mb, 2);
+		} else if (spec.kind == "cache") {
+			a.assign(32 * mb, 1);
+		} else if (spec.kind == "disk") {
+			a.assign(mb, 1);
+			const char* tmp = getenv("TMPDIR");
+			auto path = std::string(tmp ? tmp : "/tmp") + "/measure-input-latency-XXXXXX";
+			fd = mkstemp(path.data());
+			unlink(path.c_str());
+		} else if (spec.kind == "irq") {
+			a.assign(1024, 1);
+			rx = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+			tx = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+			addr.sin_family = AF_INET;
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			socklen_t len = sizeof(addr);
+			bind(rx, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+			getsockname(rx, reinterpret_cast<sockaddr*>(&addr), &len);
+		}
+
+		std::uint64_t x = 88172645463325252ULL;
+		std::size_t offset = 0;
+		volatile double sink = 0;
+
+		const auto work = [&]() {
+			if (spec.kind == "cpu") {
+				double v = sink;
+				for (int i = 0; i < 1000; ++i) {
+					v = v * 1.0000001 + 1;
+				}
+				sink = v;
+			} else if (spec.kind == "mem") {
+				std::memcpy(b.data() + offset, a.data() + offset, mb);
+				offset = (offset + mb) % a.size();
+			} else if (spec.kind == "cache") {
+				for (int i = 0; i < 4096; ++i) {
+					x ^= x << 13;
+					x ^= x >> 7;
+					x ^= x << 17;
+					++a[x % a.size()];
+				}
+			} else if (spec.kind == "disk") {
+				if (pwrite(fd, a.data(), mb, offset) > 0) {
+					fdatasync(fd);
+				}
+				offset = (offset + mb) % (64 * mb);
+			} else if (spec.kind == "irq") {
+				for (int i = 0; i < 64; ++i) {
+					sendto(tx, a.data(), a.size(), 0, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+				}
+				while (recv(rx, a.data(), a.size(), 0) > 0) {
+				}
+			}
+		};
+
+		const auto period = std::chrono::milliseconds(10);
+		const auto busy = period * spec.intensity / 100;
+
+		while (!_stop.load(std::memory_order_relaxed)) {
+			const auto start = std::chrono::steady_clock::now();
+			std::uint64_t done = 0;
+
+			do {
+				work();
+				++done;
+			} while (std::chrono::steady_clock::now() - start < busy);
+
+			ops += done;
+
+			if (spec.intensity < 100) {
+				std::this_thread::sleep_until(start + period);
+			}
+		}
+
+		for (const auto f : { fd, rx, tx }) {
+			if (f >= 0) {
+				close(f);
+			}
+		}
+	}
+
+	std::chrono::steady_clock::time_point _start;
+	std::vector<std::atomic<std::uint64_t>> _ops;
+	std::atomic<bool> _stop { false };
+	std::mutex _mutex;
+	std::condition_variable _ready;
+	std::size_t _started = 0;
+	bool _failed = false;
+	std::vector<std::thread> _threads;
+};
+
+bool jitter_rejected() {
+	return config.max_jitter && ((g_jitter_before && g_jitter_before->p99 > *config.max_jitter) ||
+	                             (g_jitter_during && g_jitter_during->p99 > *config.max_jitter));
+}
+
+// Common start of every measurement: scheduling, the host baseline, the
+// config line and GPIO.
+void prepare_run() {
+	set_realtime(config.priority);
+
+	if (config.jitter > 0) {
+		g_jitter_before = summarize(measure_wakeups(config.jitter, std::chrono::milliseconds(1)));
+
+		if (jitter_rejected()) {
+			std::cerr << "Host too noisy: wakeup p99 " << g_jitter_before->p99.count() << "ns exceeds --max-jitter" << std::endl;
+			exit(1);
+		}
+	}
+
+	if (config.summary) {
+		print_config();
+	}
+
+	init_pins();
+}
+
+// The virtual keyboard of a --uinput run, or -1.
+int g_uinput = -1;
+
+// Presses or releases a key: through its GPIO pin, or in loopback mode as a
+// key event injected through uinput.
+void write_key(const key_binding& key, const int level) {
+	if (g_uinput < 0) {
+		digitalWrite(key.pin, level);
+		return;
+	}
+
+	input_event events[2] = {};
+	events[0].type = EV_KEY;
+	events[0].code = key.code;
+	events[0].value = level == HIGH ? 1 : 0;
+	events[1].type = EV_SYN;
+	events[1].code = SYN_REPORT;
+
+	if (write(g_uinput, events, sizeof(events)) < 0) {
+		std::cerr << "Could not write to uinput: " << std::strerror(errno) << std::endl;
+		exit(1);
+	}
+}
+
+std::vector<std::chrono::microseconds> get_delays() {
+	// Don't really care about real randomness, as we're only using this to get
+	// a uniform distribution.
+	std::mt19937 rand_gen(30378);
+	std::uniform_int_distribution<int> int_dist { config.delay_min, config.delay_max };
+	std::vector<std::chrono::microseconds> ret(config.iterations);
+
+	std::generate(std::begin(ret), std::end(ret), [&]() { return std::chrono::microseconds(int_dist(rand_gen)); });
+
+	return ret;
+}
+
+class Schedule {
+	public:
+
+	// Hands out delays and keys a trial at a time, so long runs don't hold
+	// the whole schedule in memory. Delays follow the same sequence as
+	// get_delays().
+	Schedule() : _delay_gen(30378), _key_gen(30379), _delay_dist(config.delay_min, config.delay_max) {}
+
+	std::chrono::microseconds delay() {
+		return std::chrono::microseconds(_delay_dist(_delay_gen));
+	}
+
+	// Every key gets the same number of trials in each block, shuffled so
+	// that scan order effects don't line up with the trial order.
+	std::size_t key() {
+		if (_next == _block.size()) {
+			_block.resize(config.keys.size() * 16);
+			for (std::size_t i = 0; i < _block.size(); ++i) {
+				_block[i] = i % config.keys.size();
+			}
+
+			std::shuffle(std::begin(_block), std::end(_block), _key_gen);
+			_next = 0;
+		}
+
+		return _block[_next++];
+	}
+
+	private:
+	std::mt19937 _delay_gen;
+	std::mt19937 _key_gen;
+	std::uniform_int_distribution<int> _delay_dist;
+	std::vector<std::size_t> _block;
+	std::size_t _next = 0;
+};
+
+void print_event_paths() {
+	for (int event_id = 0; event_id < 256; ++event_id) {
+		try {
+			Event event(event_id);
+			std::cout << "[" << event.id() << "] " << event.name() << std::endl;
+		} catch (const Event::OpenException&) {
+			continue;
+		}
+	}
+}
+
+class MappedFile {
+	public:
+
+	// Read-only mapping of a whole file. Empty files map to nothing.
+	MappedFile(const std::string& path) {
+		const int fd = open(path.c_str(), O_RDONLY);
+
+		if (fd < 0) {
+			throw std::runtime_error("could not open " + path);
+		}
+
+		struct stat st;
+		fstat(fd, &st);
+		_size = st.st_size;
+
+		if (_size > 0) {
+			_data = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+		}
+
+		close(fd);
+
+		if (_data == MAP_FAILED) {
+			throw std::runtime_error("could not map " + path);
+		}
+
+		if (_size > 0) {
+			madvise(_data, _size, MADV_SEQUENTIAL);
+		}
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile() {
+		if (_data != MAP_FAILED) {
+			munmap(_data, _size);
+		}
+	}
+
+	const char* data() const {
+		return _size > 0 ? static_cast<const char*>(_data) : "";
+	}
+
+	std::size_t size() const {
+		return _size;
+	}
+
+	private:
+	void* _data = MAP_FAILED;
+	std::size_t _size = 0;
+};
+
+struct store_header {
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t num_keys;
+	std::uint64_t chunk_trials;
+	std::uint64_t chunk_bytes;
+	// Trials written so far; everything past it is garbage.
+	std::uint64_t count;
+	std::uint32_t codes[256];
+	char config[2048];
+	// Version 2: the device of each key, 0 for --usb and 1 for --ab.
+	std::uint8_t devices[256];
+};
+
+const std::size_t g_store_header_bytes = 4096;
+const std::size_t g_store_chunk_trials = 65536;
+const char g_store_magic[8] = { 'M', 'I', 'L', 'S', 'T', 'O', 'R', 'E' };
+
+// Chunks are whole pages, so each one can be mapped on its own.
+std::size_t store_chunk_bytes() {
+	return (trial_records::bytes(g_store_chunk_trials) + 4095) / 4096 * 4096;
+}
+
+static_assert(sizeof(store_header) <= g_store_header_bytes, "store header must fit its page");
+static_assert(sizeof(off_t) >= 8, "stores pass 2GB; build with -D_FILE_OFFSET_BITS=64");
+
+// Maps `bytes` of `fd` from `offset`, which needn't be page aligned.
+// Returns the start of the range and the mapping to unmap later.
+std::pair<char*, std::pair<void*, std::size_t>> map_range(const int fd, const off_t offset, const std::size_t bytes, const int prot) {
+	const auto skip = static_cast<std::size_t>(offset % sysconf(_SC_PAGESIZE));
+	void* map = mmap(nullptr, bytes + skip, prot, MAP_SHARED, fd, offset - skip);
+
+	if (map == MAP_FAILED) {
+		return { nullptr, { MAP_FAILED, 0 } };
+	}
+
+	return { static_cast<char*>(map) + skip, { map, bytes + skip } };
+}
+
+class TrialStore {
+	public:
+
+	// Append-only trial store: a header page, then chunks laid out like
+	// trial_records. The file grows a chunk at a time, and only the header
+	// and the chunk being written are mapped. Each full chunk is synced and
+	// unmapped, so memory and address space stay flat and a crash loses at
+	// most the chunk being written.
+	TrialStore(const std::string& path) {
+		if (config.keys.size() > 256) {
+			throw std::runtime_error("stores hold at most 256 keys");
+		}
+
+		_fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+		if (_fd < 0) {
+			throw std::runtime_error("could not open " + path);
+		}
+
+		_chunk_bytes = store_chunk_bytes();
+
+		grow();
+
+		auto& h = header();
+		std::memcpy(h.magic, g_store_magic, sizeof(h.magic));
+		h.version = 2;
+		h.num_keys = config.keys.size();
+		h.chunk_trials = g_store_chunk_trials;
+		h.chunk_bytes = _chunk_bytes;
+		h.count = 0;
+
+		for (std::size_t k = 0; k < config.keys.size(); ++k) {
+			h.codes[k] = config.keys[k].code;
+			h.devices[k] = config.keys[k].device;
+		}
+
+		// A truncated config wouldn't be valid json any more.
+		const auto json = config_json();
+		if (json.size() >= sizeof(h.config)) {
+			throw std::runtime_error("config is " + std::to_string(json.size()) + " bytes, the header holds " + std::to_string(sizeof(h.config) - 1));
+		}
+		std::strcpy(h.config, json.c_str());
+
+		msync(_header, g_store_header_bytes, MS_SYNC);
+	}
+
+	TrialStore(const TrialStore&) = delete;
+	TrialStore& operator=(const TrialStore&) = delete;
+
+	~TrialStore() {
+		if (_chunk.first != MAP_FAILED) {
+			msync(_chunk.first, _chunk.second, MS_SYNC);
+			munmap(_chunk.first, _chunk.second);
+		}
+
+		if (_header != MAP_FAILED) {
+			msync(_header, g_store_header_bytes, MS_SYNC);
+			munmap(_header, g_store_header_bytes);
+		}
+
+		if (_fd >= 0) {
+			close(_fd);
+		}
+	}
+
+	// Records holding trial i, with i's index in them returned in j. Trials
+	// must be written in order.
+	trial_records& slot(const std::size_t i, std::size_t& j) {
+		if (i / g_store_chunk_trials >= _chunks) {
+			grow();
+		}
+
+		j = i % g_store_chunk_trials;
+
+		return _current;
+	}
+
+	// Makes the first `count` trials visible to readers. The release store
+	// orders it after the trials' own stores, which readers on weakly
+	// ordered CPUs could otherwise see later.
+	void commit(const std::size_t count) {
+		__atomic_store_n(&header().count, count, __ATOMIC_RELEASE);
+	}
+
+	private:
+	store_header& header() {
+		return *reinterpret_cast<store_header*>(_header);
+	}
+
+	// On failure the store is left as it was, so the trials committed so far
+	// can still be synced and read.
+	void grow() {
+		const off_t offset = g_store_header_bytes + static_cast<off_t>(_chunks) * _chunk_bytes;
+
+		// The first chunk brings the header page with it.
+		const off_t from = _chunks ? offset : 0;
+		if (fallocate(_fd, 0, from, offset + _chunk_bytes - from) != 0) {
+			throw std::runtime_error(std::string("could not grow store: ") + std::strerror(errno));
+		}
+
+		if (_header == MAP_FAILED) {
+			void* header = mmap(nullptr, g_store_header_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+			if (header == MAP_FAILED) {
+				throw std::runtime_error(std::string("could not map store: ") + std::strerror(errno));
+			}
+			_header = static_cast<char*>(header);
+		}
+
+		const auto [chunk, map] = map_range(_fd, offset, _chunk_bytes, PROT_READ | PROT_WRITE);
+		if (!chunk) {
+			throw std::runtime_error(std::string("could not map store: ") + std::strerror(errno));
+		}
+
+		if (_chunk.first != MAP_FAILED) {
+			msync(_chunk.first, _chunk.second, MS_SYNC);
+			msync(_header, g_store_header_bytes, MS_SYNC);
+			munmap(_chunk.first, _chunk.second);
+		}
+		_chunk = map;
+
+		// Fault the new chunk in now rather than in the middle of a trial.
+		for (std::size_t o = 0; o < _chunk_bytes; o += 4096) {
+			chunk[o] = 0;
+		}
+
+		_current = trial_records(chunk, g_store_chunk_trials);
+		++_chunks;
+	}
+
+	int _fd = -1;
+	char* _header = static_cast<char*>(MAP_FAILED);
+	// The mapping of the chunk being written, as returned by map_range.
+	std::pair<void*, std::size_t> _chunk = { MAP_FAILED, 0 };
+	std::size_t _chunk_bytes = 0;
+	std::size_t _chunks = 0;
+	trial_records _current;
+};
+
+// What an archive records about its run besides the trials.
+struct archive_meta {
+	std::string config;
+	std::vector<unsigned int> codes;
+	// Per key, as in key_binding.
+	std::vector<int> devices;
+};
+
+class StoreView {
+	public:
+
+	// Validated read-only view of a store file, possibly still being written.
+	// Like the writer, it only maps the header and one chunk at a time.
+	StoreView(const std::string& path) {
+		_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+		if (_fd < 0) {
+			throw std::runtime_error("could not open " + path);
+		}
+
+		// The destructor doesn't run for a throwing constructor.
+		const auto fail = [&](const std::string& what) {
+			release();
+			throw std::runtime_error(what);
+		};
+
+		struct stat st;
+		fstat(_fd, &st);
+		const auto size = static_cast<std::uint64_t>(st.st_size);
+
+		if (size < g_store_header_bytes) {
+			fail(path + " is not a store");
+		}
+
+		void* header = mmap(nullptr, g_store_header_bytes, PROT_READ, MAP_SHARED, _fd, 0);
+		if (header == MAP_FAILED) {
+			fail("could not map " + path);
+		}
+		_header = static_cast<const char*>(header);
+
+		const auto& h = this->header();
+
+		if (
+			std::memcmp(h.magic, g_store_magic, sizeof(h.magic)) != 0 ||
+			(h.version != 1 && h.version != 2) ||
+			h.num_keys > 256 ||
+			// Every writer has used the same chunk layout; anything else is
+			// corrupt, and checking it here keeps the offset math in range.
+			h.chunk_trials != g_store_chunk_trials ||
+			h.chunk_bytes != store_chunk_bytes()
+		) {
+			fail(path + " is not a store");
+		}
+
+		// Pairs with the writer's release store in TrialStore::commit.
+		_count = __atomic_load_n(&h.count, __ATOMIC_ACQUIRE);
+		_chunk_trials = h.chunk_trials;
+		_chunk_bytes = h.chunk_bytes;
+
+		// Divide rather than multiply, so a corrupt count can't wrap around.
+		if (chunks() > (size - g_store_header_bytes) / _chunk_bytes) {
+			fail(path + " is truncated");
+		}
+	}
+
+	StoreView(const StoreView&) = delete;
+	StoreView& operator=(const StoreView&) = delete;
+
+	~StoreView() {
+		release();
+	}
+
+	const store_header& header() const {
+		return *reinterpret_cast<const store_header*>(_header);
+	}
+
+	std::size_t size() const {
+		return _count;
+	}
+
+	std::size_t chunks() const {
+		return _count / _chunk_trials + (_count % _chunk_trials != 0);
+	}
+
+	// Number of valid trials in chunk c.
+	std::size_t chunk_size(const std::size_t c) const {
+		return std::min(_chunk_trials, _count - c * _chunk_trials);
+	}
+
+	// Records over chunk c, straight from the file. They must only be read,
+	// and only until the next call.
+	trial_records chunk(const std::size_t c) {
+		if (_chunk.first != MAP_FAILED) {
+			munmap(_chunk.first, _chunk.second);
+			_chunk = { MAP_FAILED, 0 };
+		}
+
+		const auto [data, map] = map_range(_fd, g_store_header_bytes + static_cast<off_t>(c) * _chunk_bytes, _chunk_bytes, PROT_READ);
+		if (!data) {
+			throw std::runtime_error(std::string("could not map store chunk: ") + std::strerror(errno));
+		}
+		_chunk = map;
+		madvise(_chunk.first, _chunk.second, MADV_SEQUENTIAL);
+
+		return trial_records(data, _chunk_trials);
+	}
+
+	private:
+	void release() {
+		if (_chunk.first != MAP_FAILED) {
+			munmap(_chunk.first, _chunk.second);
+		}
+
+		if (_header) {
+			munmap(const_cast<char*>(_header), g_store_header_bytes);
+		}
+
+		if (_fd >= 0) {
+			close(_fd);
+		}
+	}
+
+	int _fd = -1;
+	const char* _header = nullptr;
+	std::pair<void*, std::size_t> _chunk = { MAP_FAILED, 0 };
+	// Snapshot of the header count, which a running writer keeps bumping.
+	std::size_t _count = 0;
+	std::size_t _chunk_trials = 0;
+	std::size_t _chunk_bytes = 0;
+};
+
+trial_records load_store(const std::string& path, archive_meta* meta = nullptr) {
+	StoreView store(path);
+	const auto& h = store.header();
+
+	if (meta) {
+		meta->config = std::string(h.config, strnlen(h.config, sizeof(h.config)));
+		meta->codes.assign(h.codes, h.codes + h.num_keys);
+		meta->devices.assign(h.num_keys, 0);
+		if (h.version >= 2) {
+			meta->devices.assign(h.devices, h.devices + h.num_keys);
+		}
+	}
+
+	trial_records ret(store.size());
+
+	for (std::size_t c = 0; c < store.chunks(); ++c) {
+		ret.copy(store.chunk(c), 0, c * h.chunk_trials, store.chunk_size(c));
+	}
+
+	return ret;
+}
+
+// Just the latencies, without pulling every column into memory.
+std::vector<std::chrono::nanoseconds> load_store_times(const std::string& path) {
+	StoreView store(path);
+	std::vector<std::chrono::nanoseconds> ret;
+	ret.reserve(store.size());
+
+	for (std::size_t c = 0; c < store.chunks(); ++c) {
+		const auto chunk = store.chunk(c);
+		ret.insert(std::end(ret), chunk.time.begin(), chunk.time.begin() + store.chunk_size(c));
+	}
+
+	return ret;
+}
+
+// Calls f(records, j, i) for every trial i, which is at index j of
+// records. A run in memory is one set of records; a store is read a chunk
+// at a time, so the analyses below never need all of it at once.
+template <typename F>
+void for_each_trial(const trial_records& trials, F f) {
+	for (std::size_t i = 0; i < trials.size(); ++i) {
+		f(trials, i, i);
+	}
+}
+
+template <typename F>
+void for_each_trial(StoreView& store, F f) {
+	for (std::size_t c = 0; c < store.chunks(); ++c) {
+		const auto chunk = store.chunk(c);
+		for (std::size_t j = 0; j < store.chunk_size(c); ++j) {
+			f(chunk, j, c * store.header().chunk_trials + j);
+		}
+	}
+}
+
+// Differences between latencies, binned like RunningSummary but signed.
+class SignedSummary {
+	public:
+
+	void add(const std::chrono::nanoseconds d) {
+		if (d.count() < 0) {
+			_negative.add(-d);
+		} else if (d.count() > 0) {
+			_positive.add(d);
+		} else {
+			++_zeros;
+		}
+	}
+
+	std::size_t size() const {
+		return _negative.count() + _zeros + _positive.count();
+	}
+
+	// The rank-th smallest difference (from 0).
+	std::chrono::nanoseconds at(const std::size_t rank) const {
+		if (rank < _negative.count()) {
+			return -_negative.at(_negative.count() - 1 - rank);
+		}
+
+		if (rank < _negative.count() + _zeros) {
+			return {};
+		}
+
+		return _positive.at(rank - _negative.count() - _zeros);
+	}
+
+	private:
+	RunningSummary _negative;
+	RunningSummary _positive;
+	std::size_t _zeros = 0;
+};
+
+// Where the analyses collect latencies: exactly for runs in memory, binned
+// for stores, which needn't fit in memory.
+template <typename T>
+using latencies = std::conditional_t<std::is_same_v<std::remove_const_t<T>, StoreView>, RunningSummary, std::vector<std::chrono::nanoseconds>>;
+
+template <typename T>
+using latency_diffs = std::conditional_t<std::is_same_v<std::remove_const_t<T>, StoreView>, SignedSummary, std::vector<std::chrono::nanoseconds>>;
+
+void collect(std::vector<std::chrono::nanoseconds>& times, const std::chrono::nanoseconds t) {
+	times.push_back(t);
+}
+
+void collect(RunningSummary& times, const std::chrono::nanoseconds t) {
+	times.add(t);
+}
+
+void collect(SignedSummary& diffs, const std::chrono::nanoseconds d) {
+	diffs.add(d);
+}
+
+summary summarize(const RunningSummary& times) {
+	return times.get();
+}
+
+const char g_pack_magic[8] = { 'M', 'I', 'L', 'P', 'A', 'C', 'K', 0 };
+
+inline std::int64_t column_value(const std::chrono::nanoseconds v) {
+	return v.count();
+}
+
+inline std::int64_t column_value(const std::uint32_t v) {
+	return v;
+}
+
+// Delta + zigzag + LEB128 varint. Neighbouring trials have similar
+// latencies and timestamps, so most values take one or two bytes.
+template <typename T>
+void encode_column(const Column<T>& column, std::string& out) {
+	std::int64_t prev = 0;
+
+	for (const auto& v : column) {
+		const auto value = column_value(v);
+		const auto delta = static_cast<std::uint64_t>(value) - static_cast<std::uint64_t>(prev);
+		auto zigzag = (delta << 1) ^ static_cast<std::uint64_t>(static_cast<std::int64_t>(delta) >> 63);
+		prev = value;
+
+		while (zigzag >= 0x80) {
+			out.push_back(static_cast<char>(zigzag | 0x80));
+			zigzag >>= 7;
+		}
+		out.push_back(static_cast<char>(zigzag));
+	}
+}
+
+// Returns the end of the column's data, or nullptr if it runs past `end`.
+template <typename T>
+const unsigned char* decode_column(const unsigned char* in, const unsigned char* end, const Column<T>& column) {
+	std::int64_t prev = 0;
+
+	for (auto& v : column) {
+		std::uint64_t zigzag = 0;
+		int shift = 0;
+
+		while (true) {
+			if (in == end || shift > 63) {
+				return nullptr;
+			}
+
+			const auto byte = *in++;
+			zigzag |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+			shift += 7;
+
+			if (!(byte & 0x80)) {
+				break;
+			}
+		}
+
+		const auto delta = (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+		prev = static_cast<std::int64_t>(static_cast<std::uint64_t>(prev) + delta);
+		v = static_cast<T>(prev);
+	}
+
+	return in;
+}
+
+// Pack layout: magic, version, key codes, their devices (version 2), config
+// json, trial count, then every column as a byte length and its encoded
+// values.
+std::string pack_records(const trial_records& trials, const archive_meta& meta) {
+	std::string out(g_pack_magic, sizeof(g_pack_magic));
+
+	const auto put = [&](const auto value) {
+		out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+	};
+
+	put(std::uint32_t(2));
+	put(static_cast<std::uint32_t>(meta.codes.size()));
+	for (const auto code : meta.codes) {
+		put(static_cast<std::uint32_t>(code));
+	}
+	for (std::size_t k = 0; k < meta.codes.size(); ++k) {
+		put(static_cast<std::uint32_t>(k < meta.devices.size() ? meta.devices[k] : 0));
+	}
+	put(static_cast<std::uint32_t>(meta.config.size()));
+	out += meta.config;
+	put(static_cast<std::uint64_t>(trials.size()));
+
+	trials.each_column([&](const auto& column) {
+		std::string encoded;
+		encode_column(column, encoded);
+		put(static_cast<std::uint64_t>(encoded.size()));
+		out += encoded;
+	});
+
+	return out;
+}
+
+trial_records unpack_records(const unsigned char* data, const std::size_t size, archive_meta* meta = nullptr) {
+	const unsigned char* in = data;
+	const unsigned char* end = data + size;
+
+	const auto get = [&](auto& value) {
+		if (static_cast<std::size_t>(end - in) < sizeof(value)) {
+			throw std::runtime_error("truncated pack");
+		}
+		std::memcpy(&value, in, sizeof(value));
+		in += sizeof(value);
+	};
+
+	if (size < sizeof(g_pack_magic) || std::memcmp(data, g_pack_magic, sizeof(g_pack_magic)) != 0) {
+		throw std::runtime_error("not a pack");
+	}
+	in += sizeof(g_pack_magic);
+
+	std::uint32_t version;
+	std::uint32_t num_keys;
+	get(version);
+	get(num_keys);
+
+	if (version != 1 && version != 2) {
+		throw std::runtime_error("unknown pack version");
+	}
+
+	// Counts come from the file, so they're checked against the bytes left
+	// before anything is allocated for them.
+	const std::size_t key_bytes = (version >= 2 ? 2 : 1) * sizeof(std::uint32_t);
+	if (num_keys > static_cast<std::size_t>(end - in) / key_bytes) {
+		throw std::runtime_error("truncated pack");
+	}
+
+	std::vector<std::uint32_t> codes(num_keys);
+	for (auto& code : codes) {
+		get(code);
+	}
+
+	std::vector<std::uint32_t> devices(num_keys);
+	if (version >= 2) {
+		for (auto& device : devices) {
+			get(device);
+		}
+	}
+
+	std::uint32_t json_size;
+	get(json_size);
+	if (static_cast<std::size_t>(end - in) < json_size) {
+		throw std::runtime_error("truncated pack");
+	}
+	if (meta) {
+		meta->config = std::string(reinterpret_cast<const char*>(in), json_size);
+		meta->codes.assign(std::begin(codes), std::end(codes));
+		meta->devices.assign(std::begin(devices), std::end(devices));
+	}
+	in += json_size;
+
+	std::uint64_t count;
+	get(count);
+
+	// Every trial takes at least one byte per column.
+	std::size_t columns = 0;
+	trial_records().each_column([&](const auto&) { ++columns; });
+	if (count > static_cast<std::uint64_t>(end - in) / columns) {
+		throw std::runtime_error("truncated pack");
+	}
+
+	trial_records ret(count);
+
+	ret.each_column([&](const auto& column) {
+		std::uint64_t bytes;
+		get(bytes);
+
+		if (static_cast<std::uint64_t>(end - in) < bytes || decode_column(in, in + bytes, column) != in + bytes) {
+			throw std::runtime_error("corrupt pack column");
+		}
+
+		in += bytes;
+	});
+
+	for (const auto key : ret.key) {
+		if (key >= std::max<std::uint32_t>(num_keys, 1)) {
+			throw std::runtime_error("corrupt pack column");
+		}
+	}
+
+	return ret;
+}
+
+// Parses measure() output: one latency per line, optionally preceded by a
+// key code (keymap runs) or by the full --records columns, and in --ab runs
+// by the device before those. Summary lines and anything else are skipped.
+// The text is split at line boundaries and parsed in place by `threads`
+// threads.
+trial_records parse_text(const char* data, const std::size_t size, archive_meta* meta, const unsigned int threads) {
+	const std::size_t record_width = 10;
+	const std::size_t max_width = record_width + 1;
+
+	// Idle, pulse and sequence lines aren't trials, though "<idle> <latency>"
+	// reads like a keymap line. With --summary the config line ahead of them
+	// names the mode, and then none of them are taken.
+	for (const char* p = data; p < data + size && *p == '{';) {
+		const auto* nl = static_cast<const char*>(std::memchr(p, '\n', data + size - p));
+		const std::string line(p, nl ? nl : data + size);
+
+		for (const auto mode : { "\"idle\":", "\"pulse\":", "\"sequence\":" }) {
+			const auto at = line.find(mode);
+			if (at != std::string::npos && line.compare(at + std::strlen(mode), 4, "null") != 0) {
+				if (meta) {
+					meta->codes = { 0 };
+					meta->devices = { 0 };
+				}
+				return trial_records();
+			}
+		}
+
+		p = nl ? nl + 1 : data + size;
+	}
+
+	std::vector<std::size_t> bounds(threads + 1, size);
+	bounds[0] = 0;
+	for (unsigned int t = 1; t < threads; ++t) {
+		const auto* nl = static_cast<const char*>(std::memchr(data + size * t / threads, '\n', size - size * t / threads));
+		bounds[t] = std::max(bounds[t - 1], nl ? static_cast<std::size_t>(nl - data) + 1 : size);
+	}
+
+	struct parsed {
+		std::vector<std::int64_t> values;
+		std::vector<std::uint8_t> widths;
+	};
+	std::vector<parsed> parts(threads);
+	std::vector<std::thread> workers;
+
+	for (unsigned int t = 0; t < threads; ++t) {
+		workers.emplace_back([&, t]() {
+			auto& part = parts[t];
+			const char* p = data + bounds[t];
+			const char* end = data + bounds[t + 1];
+
+			while (p < end) {
+				const auto* nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+				const char* line_end = nl ? nl : end;
+
+				std::int64_t row[max_width];
+				std::size_t width = 0;
+				bool valid = true;
+
+				for (const char* q = p; q < line_end && valid;) {
+					if (*q == ' ' || *q == '\t' || *q == '\r') {
+						++q;
+						continue;
+					}
+
+					const auto [next, ec] = std::from_chars(q, line_end, row[width < max_width ? width : 0]);
+					valid = ec == std::errc() && width < max_width;
+					++width;
+					q = next;
+				}
+
+				if (valid && (width == 1 || width == 2 || width == 3 || width == record_width || width == max_width)) {
+					part.values.insert(std::end(part.values), row, row + width);
+					part.widths.push_back(width);
+				}
+
+				p = line_end + 1;
+			}
+		});
+	}
+
+	for (auto& w : workers) {
+		w.join();
+	}
+
+	// Lines tagged with a device have an odd width past the latency alone.
+	const auto tagged = [](const std::size_t width) { return width == 3 || width == max_width; };
+	const auto key_of = [&](const std::int64_t* row, const std::size_t width) {
+		return tagged(width) ? std::make_pair(row[0], row[1]) : std::make_pair(std::int64_t(0), row[0]);
+	};
+
+	// Device and key code pairs get indices in order of first appearance.
+	std::map<std::pair<std::int64_t, std::int64_t>, std::uint32_t> key_index;
+	std::vector<unsigned int> codes;
+	std::vector<int> devices;
+	std::size_t count = 0;
+	for (const auto& part : parts) {
+		std::size_t v = 0;
+		for (const auto width : part.widths) {
+			const auto key = key_of(&part.values[v], width);
+			if (width > 1 && key_index.emplace(key, key_index.size()).second) {
+				devices.push_back(key.first);
+				codes.push_back(key.second);
+			}
+			v += width;
+		}
+		count += part.widths.size();
+	}
+
+	if (meta) {
+		meta->codes = codes.empty() ? std::vector<unsigned int> { 0 } : codes;
+		meta->devices = devices.empty() ? std::vector<int> { 0 } : devices;
+	}
+
+	trial_records ret(count);
+	workers.clear();
+
+	std::size_t first = 0;
+	for (unsigned int t = 0; t < threads; ++t) {
+		workers.emplace_back([&, t, first]() {
+			const auto& part = parts[t];
+			std::size_t v = 0;
+			auto i = first;
+
+			for (const auto width : part.widths) {
+				const auto* row = &part.values[v];
+
+				ret.key[i] = width > 1 ? key_index.at(key_of(row, width)) : 0;
+				ret.time[i] = std::chrono::nanoseconds(row[width - 1]);
+
+				if (width >= record_width) {
+					const auto* r = tagged(width) ? row + 1 : row;
+					ret.planned[i] = std::chrono::nanoseconds(r[1]);
+					ret.slept[i] = std::chrono::nanoseconds(r[2]);
+					ret.press[i] = std::chrono::nanoseconds(r[3]);
+					ret.release[i] = std::chrono::nanoseconds(r[4]);
+					ret.kernel[i] = std::chrono::nanoseconds(r[5]);
+					ret.released[i] = std::chrono::nanoseconds(r[6]);
+					ret.polls[i] = r[7];
+					ret.flags[i] = r[8];
+				} else {
+					ret.planned[i] = ret.slept[i] = ret.press[i] = ret.release[i] = ret.kernel[i] = ret.released[i] = {};
+					ret.polls[i] = 0;
+					ret.flags[i] = 0;
+				}
+
+				v += width;
+				++i;
+			}
+		});
+		first += parts[t].widths.size();
+	}
+
+	for (auto& w : workers) {
+		w.join();
+	}
+
+	return ret;
+}
+
+std::string archive_format(const std::string& path) {
+	char magic[8] = {};
+	if (path != "-") {
+		std::ifstream(path, std::ios::binary).read(magic, sizeof(magic));
+	}
+
+	if (std::memcmp(magic, g_pack_magic, sizeof(magic)) == 0) {
+		return "pack";
+	} else if (std::memcmp(magic, g_store_magic, sizeof(magic)) == 0) {
+		return "store";
+	}
+
+	return "text";
+}
+
+// Loads a store, a pack or measure() text output ('-' for stdin),
+// whichever `path` is. Text is parsed on `threads` threads, or one per core.
+trial_records load_archive(const std::string& path, archive_meta* meta = nullptr, unsigned int threads = 0) {
+	const auto format = archive_format(path);
+
+	if (threads == 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	if (format == "store") {
+		return load_store(path, meta);
+	}
+
+	if (path == "-") {
+		std::stringstream ss;
+		ss << std::cin.rdbuf();
+		const auto text = ss.str();
+		return parse_text(text.data(), text.size(), meta, threads);
+	}
+
+	const MappedFile file(path);
+
+	if (format == "pack") {
+		return unpack_records(reinterpret_cast<const unsigned char*>(file.data()), file.size(), meta);
+	}
+
+	return parse_text(file.data(), file.size(), meta, threads);
+}
+
+// Just the latencies of any archive; stores skip the other columns.
+std::vector<std::chrono::nanoseconds> load_archive_times(const std::string& path, const unsigned int threads = 0) {
+	if (path != "-" && archive_format(path) == "store") {
+		return load_store_times(path);
+	}
+
+	const auto trials = load_archive(path, nullptr, threads);
+	return std::vector<std::chrono::nanoseconds>(std::begin(trials.time), std::end(trials.time));
+}
+
+enum class flight_kind : std::uint16_t { sleep, wake, write, evdev, pin, detect };
+
+struct flight_event {
+	std::int64_t time;
+	std::int64_t kernel;
+	std::uint32_t trial;
+	flight_kind kind;
+	std::uint16_t code;
+	std::int32_t value;
+};
+
+class FlightRecorder {
+	public:
+
+	// Keeps the last `events` raw events (evdev reads, pin edges,
+	// sleeps, writes, detections) in a fixed ring that's only ever written
+	// by the measuring thread, so recording is a single store. With
+	// --flight, the window around an outlier or a timeout is dumped to a file.
+	FlightRecorder() : _ring(events) {}
+
+	void trial(const std::uint32_t trial) {
+		_trial = trial;
+	}
+
+	void record(const flight_kind kind, const std::chrono::high_resolution_clock::time_point time, const int code = 0, const int value = 0, const std::chrono::nanoseconds kernel = {}) {
+		_ring[_next++ % events] = {
+			std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count(), kernel.count(),
+			_trial, kind, static_cast<std::uint16_t>(code), value
+		};
+	}
+
+	// Writes the events since `since` with a line saying why.
+	void dump(const std::string& reason, const std::chrono::high_resolution_clock::time_point since, const std::chrono::nanoseconds latency = {}) {
+		if (_dumps >= max_dumps) {
+			return;
+		}
+
+		const auto path = config.flight_dir + "/flight-" + std::to_string(_dumps++) + ".txt";
+		std::ofstream out(path);
+		if (!out) {
+			std::cerr << "Could not write " << path << std::endl;
+			return;
+		}
+
+		const char* const names[] = { "sleep", "wake", "write", "evdev", "pin", "detect" };
+		const auto from = std::chrono::duration_cast<std::chrono::nanoseconds>(since.time_since_epoch()).count();
+
+		out << "{\"flight\":{\"reason\":" << json_string(reason) << ",\"trial\":" << _trial << ",\"latency\":" << latency.count() << "}}" << std::endl;
+		for (auto i = _next > events ? _next - events : 0; i < _next; ++i) {
+			const auto& e = _ring[i % events];
+			if (e.time >= from) {
+				out << e.time << " " << names[static_cast<int>(e.kind)] << " " << e.trial << " "
+				    << e.code << " " << e.value << " " << e.kernel << "\n";
+			}
+		}
+	}
+
+	private:
+	static constexpr std::uint64_t events = 1 << 16;
+	static constexpr int max_dumps = 100;
+
+	std::vector<flight_event> _ring;
+	std::uint64_t _next = 0;
+	std::uint32_t _trial = 0;
+	int _dumps = 0;
+};
+
+// The ring takes 2MB, so it's only there with --flight.
+std::optional<FlightRecorder> g_flight;
+
+struct detection {
+	std::size_t key;
+	bool pressed;
+	std::chrono::high_resolution_clock::time_point time;
+	std::optional<std::chrono::nanoseconds> kernel = {};
+};
+
+struct sequence_trial {
+	std::vector<std::optional<std::chrono::nanoseconds>> edges;
+	std::size_t unexpected = 0;
+};
+
+template <typename P>
+detection wait_for(P& poll, const std::size_t key, const bool pressed, std::uint32_t& polls) {
+	detection d;
+
+	polls = 1;
+	while (!(poll(d) && d.key == key && d.pressed == pressed)) {
+		if (++polls % 1024 == 0) {
+			PROBE(poll_batch, key, pressed, polls);
+		}
+	}
+
+	if (g_flight) {
+		g_flight->record(flight_kind::detect, d.time, key, pressed);
+	}
+	PROBE(event_match, key, pressed, polls, d.time.time_since_epoch().count(), d.kernel.value_or(std::chrono::nanoseconds(0)).count());
+	return d;
+}
+
+template <typename P>
+std::optional<std::chrono::high_resolution_clock::time_point> wait_timeout(P& poll, const std::size_t key, const bool pressed) {
+	const auto deadline = std::chrono::high_resolution_clock::now() + std::chrono::microseconds(config.timeout);
+	detection d;
+
+	while (std::chrono::high_resolution_clock::now() < deadline) {
+		if (poll(d) && d.key == key && d.pressed == pressed) {
+			if (g_flight) {
+				g_flight->record(flight_kind::detect, d.time, key, pressed);
+			}
+			return d.time;
+		}
+	}
+
+	if (g_flight) {
+		g_flight->dump("timeout", deadline - 2 * std::chrono::microseconds(config.timeout));
+	}
+	return {};
+}
+
+class MetricsExporter {
+	public:
+
+	// Serves the running stats in OpenMetrics format on localhost:<port>
+	// from its own thread. The trial loop publishes into one of two buffers
+	// and bumps a sequence number; scrapes copy the other buffer and retry
+	// if the sequence moved, so neither side ever waits on the other.
+	MetricsExporter(const int port) {
+		_server = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+		const int one = 1;
+		setsockopt(_server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+		sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		if (_server < 0 || bind(_server, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(_server, 4) < 0) {
+			const std::string error = std::strerror(errno);
+			close(_server);
+			throw std::runtime_error("could not listen on port " + std::to_string(port) + ": " + error);
+		}
+
+		// Scrapes are served at normal priority, off the trial's CPU.
+		_thread = std::thread([this]() {
+			set_background();
+			serve();
+		});
+	}
+
+	~MetricsExporter() {
+		shutdown(_server, SHUT_RDWR);
+		_thread.join();
+		close(_server);
+	}
+
+	void publish(const std::chrono::nanoseconds time, const std::chrono::nanoseconds planned, const std::chrono::nanoseconds slept, const std::uint32_t polls) {
+		++_live.counts[bin(time)];
+		++_live.count;
+		_live.sum += time.count();
+		_live.missed += time > std::chrono::microseconds(config.timeout) ? 1 : 0;
+		_live.late += slept > planned + late_wakeup ? 1 : 0;
+		_live.polls += polls;
+
+		// Readers of the buffer about to be overwritten must see the
+		// sequence move before any of the new values.
+		const auto next = _seq.load(std::memory_order_relaxed) + 1;
+		std::atomic_thread_fence(std::memory_order_release);
+
+		auto& buffer = _buffers[next & 1];
+		for (std::size_t i = 0; i < bins; ++i) {
+			buffer.counts[i].store(_live.counts[i], std::memory_order_relaxed);
+		}
+		buffer.count.store(_live.count, std::memory_order_relaxed);
+		buffer.sum.store(_live.sum, std::memory_order_relaxed);
+		buffer.missed.store(_live.missed, std::memory_order_relaxed);
+		buffer.late.store(_live.late, std::memory_order_relaxed);
+		buffer.polls.store(_live.polls, std::memory_order_relaxed);
+
+		_seq.store(next, std::memory_order_release);
+	}
+
+	private:
+	// Log spaced latency bins, 8 per octave from 1us up, plus an overflow bin.
+	static constexpr int bins_per_octave = 8;
+	static constexpr std::size_t bins = bins_per_octave * 20 + 1;
+	static constexpr std::chrono::milliseconds late_wakeup { 1 };
+
+	static std::size_t bin(const std::chrono::nanoseconds time) {
+		const double us = std::max(1.0, time.count() / 1000.0);
+		return std::min(bins - 1, static_cast<std::size_t>(std::log2(us) * bins_per_octave));
+	}
+
+	static double bin_upper(const std::size_t i) {
+		return std::exp2(static_cast<double>(i + 1) / bins_per_octave) / 1e6;
+	}
+
+	template <typename T>
+	struct stats {
+		T counts[bins] = {};
+		T count = {};
+		T sum = {};
+		T missed = {};
+		T late = {};
+		T polls = {};
+	};
+
+	stats<std::uint64_t> snapshot() const {
+		for (;;) {
+			stats<std::uint64_t> ret;
+			const auto seq = _seq.load(std::memory_order_acquire);
+			const auto& buffer = _buffers[seq & 1];
+
+			for (std::size_t i = 0; i < bins; ++i) {
+				ret.counts[i] = buffer.counts[i].load(std::memory_order_relaxed);
+			}
+			ret.count = buffer.count.load(std::memory_order_relaxed);
+			ret.sum = buffer.sum.load(std::memory_order_relaxed);
+			ret.missed = buffer.missed.load(std::memory_order_relaxed);
+			ret.late = buffer.late.load(std::memory_order_relaxed);
+			ret.polls = buffer.polls.load(std::memory_order_relaxed);
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (_seq.load(std::memory_order_relaxed) == seq) {
+				return ret;
+			}
+		}
+	}
+
+	std::string render() const {
+		const auto s = snapshot();
+		std::stringstream ss;
+		ss << std::setprecision(9);
+
+		ss << "# TYPE input_latency_seconds histogram\n"
+		   << "# UNIT input_latency_seconds seconds\n"
+		   << "# HELP input_latency_seconds Time from stimulus to detection.\n";
+
+		// Buckets at every octave, from the fine bins.
+		std::uint64_t cumulative = 0;
+		for (std::size_t i = 0; i < bins - 1; ++i) {
+			cumulative += s.counts[i];
+			if ((i + 1) % bins_per_octave == 0) {
+				ss << "input_latency_seconds_bucket{le=\"" << bin_upper(i) << "\"} " << cumulative << "\n";
+			}
+		}
+		ss << "input_latency_seconds_bucket{le=\"+Inf\"} " << s.count << "\n"
+		   << "input_latency_seconds_count " << s.count << "\n"
+		   << "input_latency_seconds_sum " << s.sum / 1e9 << "\n";
+
+		ss << "# TYPE input_latency_quantile_seconds gauge\n"
+		   << "# UNIT input_latency_quantile_seconds seconds\n"
+		   << "# HELP input_latency_quantile_seconds Latency quantiles, to the upper edge of 1/8 octave bins.\n";
+		for (const auto q : { 0.5, 0.9, 0.99 }) {
+			std::uint64_t seen = 0;
+			std::size_t i = 0;
+			while (i < bins - 1 && seen + s.counts[i] < q * s.count) {
+				seen += s.counts[i++];
+			}
+
+			ss << "input_latency_quantile_seconds{quantile=\"" << q << "\"} ";
+			if (s.count == 0) {
+				ss << "NaN\n";
+			} else if (i == bins - 1) {
+				ss << "+Inf\n";
+			} else {
+				ss << bin_upper(i) << "\n";
+			}
+		}
+
+		ss << "# TYPE input_latency_missed counter\n"
+		   << "# HELP input_latency_missed Detections slower than the timeout.\n"
+		   << "input_latency_missed_total " << s.missed << "\n"
+		   << "# TYPE input_latency_late_wakeups counter\n"
+		   << "# HELP input_latency_late_wakeups Trials whose delay overslept by more than 1ms.\n"
+		   << "input_latency_late_wakeups_total " << s.late << "\n"
+		   << "# TYPE input_latency_polls counter\n"
+		   << "# HELP input_latency_polls Detector polls until a press was seen.\n"
+		   << "input_latency_polls_total " << s.polls << "\n"
+		   << "# EOF\n";
+
+		return ss.str();
+	}
+
+	void serve() {
+		for (;;) {
+			const int client = accept4(_server, nullptr, nullptr, SOCK_CLOEXEC);
+
+			if (client < 0) {
+				if (errno == EINTR || errno == ECONNABORTED) {
+					continue;
+				}
+				return;
+			}
+
+			// Every path gets the metrics, so the request itself is ignored.
+			char request[4096];
+			const timeval timeout = { 1, 0 };
+			setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+			recv(client, request, sizeof(request), 0);
+
+			const auto body = render();
+			const auto response = "HTTP/1.0 200 OK\r\n"
+			                      "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+			                      "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+			send(client, response.data(), response.size(), MSG_NOSIGNAL);
+			close(client);
+		}
+	}
+
+	int _server;
+	std::thread _thread;
+	stats<std::uint64_t> _live;
+	stats<std::atomic<std::uint64_t>> _buffers[2];
+	std::atomic<std::uint64_t> _seq { 0 };
+};
+
+const char g_feed_magic[8] = { 'M', 'I', 'L', 'F', 'E', 'E', 'D', 0 };
+const std::uint32_t g_feed_records = 1 << 16;
+
+struct feed_header {
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t capacity;
+	// Records published so far; record i is in slot i % capacity.
+	std::atomic<std::uint64_t> head;
+	std::atomic<std::uint32_t> done;
+	// Set for --ab runs, whose records lead with the device.
+	std::uint32_t ab;
+};
+
+const std::size_t g_feed_values = 11;
+
+// Per-record seqlock: odd while being written, 2 * (index + 1) once done.
+// Values are in --records order: device, code, planned, slept, press,
+// release, kernel, released, polls, flags, latency. The sequence and values
+// take two cache lines, which no other record shares.
+struct alignas(64) feed_record {
+	std::atomic<std::uint64_t> seq;
+	std::atomic<std::int64_t> values[g_feed_values];
+};
+
+static_assert(sizeof(feed_record) == 128, "feed records are two cache lines");
+
+class Feed {
+	public:
+
+	// Ring of trial records in POSIX shared memory for local readers to tail.
+	// Publishing only writes to the prefaulted mapping; the segment is
+	// unlinked at the end of the run.
+	Feed(const std::string& name) : _name(name) {
+		const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+		if (fd < 0) {
+			throw std::runtime_error("could not create " + name + ": " + std::strerror(errno));
+		}
+
+		_size = sizeof(feed_header) + sizeof(feed_record) * g_feed_records;
+
+		if (ftruncate(fd, _size) < 0) {
+			close(fd);
+			shm_unlink(name.c_str());
+			throw std::runtime_error("could not size " + name);
+		}
+
+		_data = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+		close(fd);
+
+		if (_data == MAP_FAILED) {
+			shm_unlink(name.c_str());
+			throw std::runtime_error("could not map " + name);
+		}
+
+		_header = new (_data) feed_header;
+		std::memcpy(_header->magic, g_feed_magic, sizeof(_header->magic));
+		_header->version = 2;
+		_header->capacity = g_feed_records;
+		_header->ab = has_ab_keys();
+		_header->head.store(0, std::memory_order_relaxed);
+		_header->done.store(0, std::memory_order_relaxed);
+		_records = new (static_cast<char*>(_data) + sizeof(feed_header)) feed_record[g_feed_records];
+	}
+
+	~Feed() {
+		_header->done.store(1, std::memory_order_release);
+		munmap(_data, _size);
+		shm_unlink(_name.c_str());
+	}
+
+	void publish(const trial_records& trials, const std::size_t j) {
+		const std::int64_t values[g_feed_values] = {
+			config.keys[trials.key[j]].device, config.keys[trials.key[j]].code, trials.planned[j].count(), trials.slept[j].count(),
+			trials.press[j].count(), trials.release[j].count(), trials.kernel[j].count(),
+			trials.released[j].count(), trials.polls[j], trials.flags[j], trials.time[j].count()
+		};
+
+		auto& r = _records[_next % g_feed_records];
+		r.seq.store(2 * _next + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		for (std::size_t v = 0; v < g_feed_values; ++v) {
+			r.values[v].store(values[v], std::memory_order_relaxed);
+		}
+
+		r.seq.store(2 * _next + 2, std::memory_order_release);
+		_header->head.store(++_next, std::memory_order_release);
+	}
+
+	private:
+	std::string _name;
+	void* _data;
+	std::size_t _size;
+	feed_header* _header;
+	feed_record* _records;
+	std::uint64_t _next = 0;
+};
+
+enum class kernel_kind : std::uint8_t { irq_entry, irq_exit, softirq_entry, softirq_exit, wakeup, switch_out, switch_in };
+
+struct kernel_event {
+	// CLOCK_MONOTONIC
+	std::int64_t time;
+	kernel_kind kind;
+	std::uint16_t cpu;
+};
+
+struct kernel_trace {
+	std::vector<kernel_event> events;
+	// Add to a monotonic time to get the trials' clock.
+	std::int64_t offset;
+	std::uint64_t lost_pages;
+};
+
+std::optional<kernel_trace> g_kernel_trace;
+
+// Power settings and the tracefs instance to put back when a run ends
+// through exit() or a signal instead of the Autosuspend and KernelTrace
+// destructors. Kept as plain buffers so that the signal handler only needs
+// open, write, close and rmdir.
+struct autosuspend_restore {
+	char path[PATH_MAX];
+	char value[16];
+	volatile std::sig_atomic_t active;
+};
+
+autosuspend_restore g_autosuspend[2];
+
+// The per-CPU buffers keep the instance busy, so they are closed first.
+struct trace_restore {
+	char instance[PATH_MAX];
+	int fds[CPU_SETSIZE];
+	volatile std::sig_atomic_t cpus;
+	volatile std::sig_atomic_t active;
+};
+
+trace_restore g_trace_restore;
+
+void restore_host() {
+	for (auto& r : g_autosuspend) {
+		if (!r.active) {
+			continue;
+		}
+
+		const int fd = open(r.path, O_WRONLY);
+		if (fd >= 0) {
+			while (write(fd, r.value, strlen(r.value)) < 0 && errno == EINTR) {
+			}
+			close(fd);
+		}
+		r.active = 0;
+	}
+
+	if (g_trace_restore.active) {
+		for (int i = 0; i < g_trace_restore.cpus; ++i) {
+			close(g_trace_restore.fds[i]);
+		}
+		rmdir(g_trace_restore.instance);
+		g_trace_restore.active = 0;
+	}
+}
+
+void restore_host_signal(const int sig) {
+	restore_host();
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+void hook_restore_host() {
+	static bool hooked = false;
+	if (!hooked) {
+		std::atexit(restore_host);
+		for (const auto sig : { SIGINT, SIGTERM, SIGHUP }) {
+			signal(sig, restore_host_signal);
+		}
+		hooked = true;
+	}
+}
+
+class KernelTrace {
+	public:
+
+	// Enables irq, softirq and scheduler tracepoints for thread `tid` in a
+	// tracefs instance of our own, and drains the per-CPU raw ring buffers
+	// from a background thread until stop(). IRQs are limited to the USB
+	// host controllers in /proc/interrupts.
+	KernelTrace(const pid_t tid) : _tid(tid) {
+		for (const auto root : { "/sys/kernel/tracing", "/sys/kernel/debug/tracing" }) {
+			if (access((std::string(root) + "/instances").c_str(), F_OK) == 0) {
+				_root = root;
+				break;
+			}
+		}
+
+		if (_root.empty()) {
+			throw std::runtime_error("tracefs is not mounted");
+		}
+
+		_instance = _root + "/instances/measure-input-latency-" + std::to_string(getpid());
+		if (_instance.size() >= sizeof(g_trace_restore.instance)) {
+			throw std::runtime_error("tracefs path too long: " + _root);
+		}
+
+		if (mkdir(_instance.c_str(), 0700) < 0 && errno != EEXIST) {
+			throw std::runtime_error("could not create " + _instance + ": " + std::strerror(errno));
+		}
+
+		hook_restore_host();
+		std::strcpy(g_trace_restore.instance, _instance.c_str());
+		g_trace_restore.cpus = 0;
+		g_trace_restore.active = 1;
+
+		try {
+			parse_header_page();
+
+			write_file("trace_clock", "mono");
+			write_file("buffer_size_kb", "4096");
+
+			const auto tid_filter = std::to_string(tid);
+			enable("sched", "sched_wakeup", "pid == " + tid_filter);
+			enable("sched", "sched_switch", "prev_pid == " + tid_filter + " || next_pid == " + tid_filter);
+			// Only the vectors that run input completions: HI and TASKLET
+			// for host controller bottom halves, TIMER and NET_RX for what
+			// usually preempts them.
+			const auto vec_filter = "vec == 0 || vec == 1 || vec == 3 || vec == 6";
+			enable("irq", "softirq_entry", vec_filter);
+			enable("irq", "softirq_exit", vec_filter);
+
+			const auto irqs = usb_irqs();
+			if (!irqs.empty()) {
+				std::string irq_filter;
+				for (const auto irq : irqs) {
+					irq_filter += (irq_filter.empty() ? "" : " || ") + std::string("irq == ") + std::to_string(irq);
+				}
+				enable("irq", "irq_handler_entry", irq_filter);
+				enable("irq", "irq_handler_exit", irq_filter);
+			}
+
+			write_file("tracing_on", "1");
+		} catch (const std::runtime_error&) {
+			g_trace_restore.active = 0;
+			rmdir(_instance.c_str());
+			throw;
+		}
+
+		timespec mono, real;
+		clock_gettime(CLOCK_MONOTONIC, &mono);
+		clock_gettime(CLOCK_REALTIME, &real);
+		_offset = (real.tv_sec - mono.tv_sec) * 1000000000LL + (real.tv_nsec - mono.tv_nsec);
+
+		const auto cpus = sysconf(_SC_NPROCESSORS_CONF);
+		for (long cpu = 0; cpu < cpus; ++cpu) {
+			const auto path = _instance + "/per_cpu/cpu" + std::to_string(cpu) + "/trace_pipe_raw";
+			const int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+			if (fd >= 0 && g_trace_restore.cpus < CPU_SETSIZE) {
+				_cpus.push_back({ fd, static_cast<std::uint16_t>(cpu) });
+				g_trace_restore.fds[g_trace_restore.cpus] = fd;
+				g_trace_restore.cpus = g_trace_restore.cpus + 1;
+			} else if (fd >= 0) {
+				close(fd);
+			}
+		}
+
+		_thread = std::thread([this]() {
+			set_background();
+
+			while (!_stop.load()) {
+				drain();
+				std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			}
+		});
+	}
+
+	~KernelTrace() {
+		if (_thread.joinable()) {
+			stop();
+		}
+
+		g_trace_restore.active = 0;
+		for (const auto& c : _cpus) {
+			close(c.fd);
+		}
+		rmdir(_instance.c_str());
+	}
+
+	kernel_trace stop() {
+		_stop.store(true);
+		_thread.join();
+
+		try {
+			write_file("tracing_on", "0");
+		} catch (const std::runtime_error&) {
+		}
+		drain();
+
+		std::sort(std::begin(_events), std::end(_events), [](const auto& a, const auto& b) { return a.time < b.time; });
+		return { std::move(_events), _offset, _lost };
+	}
+
+	private:
+	struct format {
+		int id = -1;
+		std::map<std::string, std::pair<int, int>> fields;
+	};
+
+	struct cpu_buffer {
+		int fd;
+		std::uint16_t cpu;
+	};
+
+	void write_file(const std::string& name, const std::string& value) {
+		std::ofstream file(_instance + "/" + name);
+		file << value << std::endl;
+
+		if (!file) {
+			throw std::runtime_error("could not write " + value + " to " + _instance + "/" + name);
+		}
+	}
+
+	static format read_format(const std::string& path) {
+		std::ifstream file(path);
+		format ret;
+
+		for (std::string line; std::getline(file, line);) {
+			if (line.rfind("ID:", 0) == 0) {
+				ret.id = std::stoi(line.substr(3));
+			}
+
+			const auto field = line.find("field:");
+			const auto semi = line.find(';', field);
+			const auto offset = line.find("offset:");
+			const auto size = line.find("size:");
+			if (field == std::string::npos || semi == std::string::npos || offset == std::string::npos || size == std::string::npos) {
+				continue;
+			}
+
+			auto name = line.substr(field + 6, semi - field - 6);
+			name = name.substr(name.find_last_of(" *") + 1);
+			name = name.substr(0, name.find('['));
+			ret.fields[name] = { std::stoi(line.substr(offset + 7)), std::stoi(line.substr(size + 5)) };
+		}
+
+		return ret;
+	}
+
+	void parse_header_page() {
+		const auto header = read_format(_root + "/events/header_page");
+		if (!header.fields.count("timestamp") || !header.fields.count("commit") || !header.fields.count("data")) {
+			throw std::runtime_error("unexpected tracefs header_page");
+		}
+
+		_commit = header.fields.at("commit");
+		_data = header.fields.at("data").first;
+	}
+
+	void enable(const std::string& system, const std::string& name, const std::string& filter) {
+		const auto f = read_format(_root + "/events/" + system + "/" + name + "/format");
+		if (f.id < 0) {
+			throw std::runtime_error("no tracepoint " + system + ":" + name);
+		}
+
+		_formats[f.id] = { name, f };
+
+		if (!filter.empty()) {
+			write_file("events/" + system + "/" + name + "/filter", filter);
+		}
+		write_file("events/" + system + "/" + name + "/enable", "1");
+	}
+
+	static std::int64_t read_int(const unsigned char* data, const std::pair<int, int>& field) {
+		switch (field.second) {
+			case 1: return *reinterpret_cast<const std::int8_t*>(data + field.first);
+			case 2: return *reinterpret_cast<const std::int16_t*>(data + field.first);
+			case 4: return *reinterpret_cast<const std::int32_t*>(data + field.first);
+			default: return *reinterpret_cast<const std::int64_t*>(data + field.first);
+		}
+	}
+
+	// IRQs of the USB host controllers, by exact driver name in
+	// /proc/interrupts: a name followed by nothing or by ":usb<n>". Looser
+	// matching catches the likes of ahci and sdhci.
+	static std::vector<int> usb_irqs() {
+		static const std::string drivers[] = { "xhci_hcd", "ehci_hcd", "ohci_hcd", "dwc_otg", "dwc2" };
+
+		std::ifstream file("/proc/interrupts");
+		std::vector<int> ret;
+
+		for (std::string line; std::getline(file, line);) {
+			const auto colon = line.find(':');
+			if (colon == std::string::npos) {
+				continue;
+			}
+
+			// Shared lines list every device, separated by commas.
+			bool usb = false;
+			std::istringstream names(line.substr(colon + 1));
+			for (std::string name; names >> name;) {
+				if (!name.empty() && name.back() == ',') {
+					name.pop_back();
+				}
+
+				name = name.substr(0, name.find(':'));
+				std::replace(std::begin(name), std::end(name), '-', '_');
+				usb = usb || std::find(std::begin(drivers), std::end(drivers), name) != std::end(drivers);
+			}
+
+			if (!usb) {
+				continue;
+			}
+
+			try {
+				ret.push_back(std::stoi(line.substr(0, colon)));
+			} catch (const std::invalid_argument&) {
+			}
+		}
+
+		return ret;
+	}
+
+	void drain() {
+		std::vector<unsigned char> page(sysconf(_SC_PAGESIZE));
+
+		for (const auto& c : _cpus) {
+			for (;;) {
+				const auto n = read(c.fd, page.data(), page.size());
+				if (n <= 0) {
+					break;
+				}
+				parse_page(page.data(), n, c.cpu);
+			}
+		}
+	}
+
+	// Walks one ring buffer page: a timestamp, the committed length, then
+	// events with 5 bits of type or length and 27 bits of time delta.
+	void parse_page(const unsigned char* page, const std::size_t size, const std::uint16_t cpu) {
+		if (size < static_cast<std::size_t>(_data)) {
+			return;
+		}
+
+		auto time = *reinterpret_cast<const std::uint64_t*>(page);
+		const auto commit = static_cast<std::uint64_t>(read_int(page, _commit));
+
+		// Flags in the top of the commit word say the writer dropped events.
+		if (commit & (1ULL << 31)) {
+			++_lost;
+		}
+
+		const auto end = std::min(size, _data + static_cast<std::size_t>(commit & 0xfffff));
+		std::size_t p = _data;
+
+		while (p + 4 <= end) {
+			const auto head = *reinterpret_cast<const std::uint32_t*>(page + p);
+			const auto type_len = head & 31;
+			const auto delta = head >> 5;
+			const auto array0 = p + 8 <= end ? *reinterpret_cast<const std::uint32_t*>(page + p + 4) : 0;
+
+			if (type_len == 29) {
+				if (delta == 0 && array0 == 0) {
+					break;
+				}
+				p += 4 + array0;
+			} else if (type_len == 30) {
+				time += delta + (static_cast<std::uint64_t>(array0) << 27);
+				p += 8;
+			} else if (type_len == 31) {
+				time = delta + (static_cast<std::uint64_t>(array0) << 27);
+				p += 8;
+			} else {
+				time += delta;
+
+				const auto data = type_len == 0 ? p + 8 : p + 4;
+				const auto length = type_len == 0 ? array0 - 4 : type_len * 4;
+				p = data + length;
+
+				if (p <= end && length >= 2) {
+					handle(page + data, time, cpu);
+				}
+			}
+		}
+	}
+
+	void handle(const unsigned char* data, const std::uint64_t time, const std::uint16_t cpu) {
+		const auto type = *reinterpret_cast<const std::uint16_t*>(data);
+		const auto it = _formats.find(type);
+		if (it == std::end(_formats)) {
+			return;
+		}
+
+		const auto& [name, f] = it->second;
+		const auto push = [&](const kernel_kind kind) {
+			_events.push_back({ static_cast<std::int64_t>(time), kind, cpu });
+		};
+
+		if (name == "irq_handler_entry") {
+			push(kernel_kind::irq_entry);
+		} else if (name == "irq_handler_exit") {
+			push(kernel_kind::irq_exit);
+		} else if (name == "softirq_entry") {
+			push(kernel_kind::softirq_entry);
+		} else if (name == "softirq_exit") {
+			push(kernel_kind::softirq_exit);
+		} else if (name == "sched_wakeup") {
+			push(kernel_kind::wakeup);
+		} else if (name == "sched_switch") {
+			if (read_int(data, f.fields.at("prev_pid")) == _tid) {
+				push(kernel_kind::switch_out);
+			} else if (read_int(data, f.fields.at("next_pid")) == _tid) {
+				push(kernel_kind::switch_in);
+			}
+		}
+	}
+
+	pid_t _tid;
+	std::string _root;
+	std::string _instance;
+	std::pair<int, int> _commit;
+	std::size_t _data = 0;
+	std::map<int, std::pair<std::string, format>> _formats;
+	std::vector<cpu_buffer> _cpus;
+	std::vector<kernel_event> _events;
+	std::int64_t _offset = 0;
+	std::uint64_t _lost = 0;
+	std::atomic<bool> _stop { false };
+	std::thread _thread;
+};
+
+class Cusum {
+	public:
+
+	// Two-sided, self-starting CUSUM. The reference mean and deviation are
+	// learned from at least `window` samples and relearned after every
+	// detected shift. The
+	// threshold is chosen so that a stationary stream raises a false alarm
+	// once every `arl` samples on average.
+	Cusum(const std::size_t window, const double arl) : _threshold(threshold(arl)), _window(window) {}
+
+	struct change {
+		std::size_t index;
+		// Press time of the first trial after the change.
+		std::chrono::nanoseconds at;
+		// Mean since the previous change, and since this one until it was
+		// detected.
+		double before;
+		double after;
+	};
+
+	// Returns the estimated change when a shift is detected. Only running
+	// sums are kept, so memory doesn't grow with the run.
+	std::optional<change> update(const double x, const std::chrono::nanoseconds at) {
+		const auto index = _index++;
+
+		// Welford's running mean and variance. Past the window, every sample
+		// is scored against the reference so far and then added to it, so a
+		// short window's estimation error doesn't become false alarms.
+		const auto learn = [&]() {
+			++_learned;
+			const double delta = x - _mean;
+			_mean += delta / _learned;
+			_m2 += delta * (x - _mean);
+		};
+
+		if (_learned < _window) {
+			learn();
+			_sum += x;
+			return {};
+		}
+
+		const double sigma = std::max(1.0, std::sqrt(_m2 / (_learned - 1)));
+		// Clamped so a single outlier can't trip the detector on its own.
+		const double z = std::clamp((x - _mean) / sigma, -_clamp, _clamp);
+		learn();
+
+		if (_high == 0) {
+			_high_start = { index, at, _sum };
+		}
+		if (_low == 0) {
+			_low_start = { index, at, _sum };
+		}
+
+		_sum += x;
+		_high = std::max(0.0, _high + z - _slack);
+		_low = std::max(0.0, _low - z - _slack);
+
+		if (_high > _threshold || _low > _threshold) {
+			const auto& start = _high > _threshold ? _high_start : _low_start;
+			const change ret {
+				start.index, start.at,
+				start.sum / (start.index - _last),
+				(_sum - start.sum) / (index + 1 - start.index)
+			};
+
+			_last = start.index;
+			_sum -= start.sum;
+			_learned = 0;
+			_mean = 0;
+			_m2 = 0;
+			_high = 0;
+			_low = 0;
+
+			return ret;
+		}
+
+		return {};
+	}
+
+	private:
+	struct start {
+		std::size_t index = 0;
+		std::chrono::nanoseconds at = {};
+		// Sum since the last change, before this sample.
+		double sum = 0;
+	};
+
+	// Siegmund's approximation of the in-control run length of a one-sided
+	// CUSUM, solved for the threshold. Each side of the two-sided detector
+	// gets twice the target, as their false alarms add up.
+	static double threshold(const double arl) {
+		const auto run_length = [](const double b) {
+			return (std::exp(b) - b - 1) / (2 * _slack * _slack);
+		};
+
+		double lo = 0, hi = 100;
+		for (int i = 0; i < 100; ++i) {
+			const double mid = (lo + hi) / 2;
+			(run_length(mid) < 2 * arl ? lo : hi) = mid;
+		}
+
+		return std::max(0.0, (lo + hi) / 2 / (2 * _slack) - 1.166);
+	}
+
+	static constexpr double _slack = 0.5;
+	static constexpr double _clamp = 2;
+
+	double _threshold;
+	std::size_t _window;
+	std::size_t _index = 0;
+	std::size_t _learned = 0;
+	double _mean = 0;
+	double _m2 = 0;
+	double _high = 0;
+	double _low = 0;
+	start _high_start;
+	start _low_start;
+	std::size_t _last = 0;
+	double _sum = 0;
+};
+
+void print_change(const std::size_t trial, const std::chrono::nanoseconds at, const long long before, const long long after) {
+	std::cout << "{\"change\":{\"trial\":" << trial << ","
+	          << "\"at\":" << at.count() << ","
+	          << "\"before\":" << before << ","
+	          << "\"after\":" << after << "}}" << std::endl;
+}
+
+// Set when measure_loop already printed changes as they were detected.
+bool g_drift_live = false;
+
+// Daemon requests print each trial's line as soon as it's measured, so the
+// client can follow the run, instead of all of them at the end.
+bool g_live_trials = false;
+
+void print_trial(std::ostream& out, const trial_records& trials, const std::size_t i) {
+	// --ab lines start with the device, so A and B can be told apart.
+	const auto ab = has_ab_keys();
+
+	if (ab) {
+		out << config.keys[trials.key[i]].device << " ";
+	}
+
+	if (config.records) {
+		out << config.keys[trials.key[i]].code << " "
+		    << trials.planned[i].count() << " "
+		    << trials.slept[i].count() << " "
+		    << trials.press[i].count() << " "
+		    << trials.release[i].count() << " "
+		    << trials.kernel[i].count() << " "
+		    << trials.released[i].count() << " "
+		    << trials.polls[i] << " "
+		    << trials.flags[i] << " ";
+	} else if (config.keymap || ab) {
+		out << config.keys[trials.key[i]].code << " ";
+	}
+	out << trials.time[i].count() << std::endl;
+}
+
+void print_sequence_trial(std::ostream& out, const sequence_trial& t) {
+	for (std::size_t e = 0; e < t.edges.size(); ++e) {
+		out << (e ? " " : "");
+		if (t.edges[e]) {
+			out << t.edges[e]->count();
+		} else {
+			out << "-";
+		}
+	}
+	out << std::endl;
+}
+
+void print_pulse_result(std::ostream& out, const pulse_result& r) {
+	out << r.width.count() << " " << r.actual.count() << " " << r.detected << " " << r.reps << std::endl;
+}
+
+void print_idle_result(std::ostream& out, const idle_result& r) {
+	out << r.idle.count() << " ";
+	if (r.time) {
+		out << r.time->count();
+	} else {
+		out << "-";
+	}
+	out << std::endl;
+}
+
+template <typename P>
+trial_records measure_loop(P poll) {
+	prepare_run();
+
+	Schedule schedule;
+
+	std::optional<TrialStore> store;
+	if (config.store) {
+		try {
+			store.emplace(*config.store);
+		} catch (const std::runtime_error& e) {
+			std::cerr << "Could not create store: " << e.what() << std::endl;
+			exit(1);
+		}
+	}
+
+	std::optional<MetricsExporter> metrics;
+	if (config.metrics) {
+		try {
+			metrics.emplace(*config.metrics);
+		} catch (const std::runtime_error& e) {
+			std::cerr << "Could not serve metrics: " << e.what() << std::endl;
+			exit(1);
+		}
+	}
+
+	std::optional<JitterProbe> probe;
+	if (config.jitter > 0) {
+		probe.emplace();
+	}
+
+	std::optional<LoadGenerator> load;
+	if (!config.load.empty()) {
+		try {
+			load.emplace(config.load);
+		} catch (const std::runtime_error& e) {
+			std::cerr << "Could not start load: " << e.what() << std::endl;
+			exit(1);
+		}
+	}
+
+	std::optional<KernelTrace> tracer;
+	if (config.tracefs) {
+		try {
+			tracer.emplace(syscall(SYS_gettid));
+		} catch (const std::runtime_error& e) {
+			std::cerr << "Could not trace the kernel (needs root): " << e.what() << std::endl;
+			exit(1);
+		}
+	}
+
+	std::optional<Feed> feed;
+	if (config.feed) {
+		try {
+			feed.emplace(*config.feed);
+		} catch (const std::runtime_error& e) {
+			std::cerr << "Could not create feed: " << e.what() << std::endl;
+			exit(1);
+		}
+	}
+
+	// Shifts are reported as soon as they are detected.
+	std::optional<Cusum> cusum;
+	std::chrono::nanoseconds first_press = {};
+	if (config.drift) {
+		cusum.emplace(*config.drift, config.drift_arl);
+		g_drift_live = true;
+	}
+
+	// With a store, trials go straight to the file instead.
+	trial_records trials(store ? 0 : config.iterations, config.hugepages);
+
+	// Outlier dumps cover the trial before as well.
+	auto previous_start = std::chrono::high_resolution_clock::now();
+
+	for (int i = 0; i < config.iterations; ++i) {
+		const auto k = schedule.key();
+		const auto delay = schedule.delay();
+		const auto& key = config.keys[k];
+
+		std::size_t j = i;
+		trial_records* records = &trials;
+		if (store) {
+			try {
+				records = &store->slot(i, j);
+			} catch (const std::runtime_error& e) {
+				// The header already counts every finished trial; closing the
+				// store syncs them.
+				store.reset();
+				std::cerr << "Stopped after " << i << " trials: " << e.what() << std::endl;
+				exit(1);
+			}
+		}
+		auto& out = *records;
+
+		if (g_flight) {
+			g_flight->trial(i);
+		}
+
+		const auto sleep_start = std::chrono::high_resolution_clock::now();
+		if (g_flight) {
+			g_flight->record(flight_kind::sleep, sleep_start, 0, delay.count());
+		}
+		PROBE(trial_start, i, k, delay.count(), sleep_start.time_since_epoch().count());
+		std::this_thread::sleep_for(delay);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		if (g_flight) {
+			g_flight->record(flight_kind::wake, start);
+		}
+
+		write_key(key, HIGH);
+		if (g_flight) {
+			g_flight->record(flight_kind::write, start, key.pin, HIGH);
+		}
+		PROBE(stimulus, i, key.pin, start.time_since_epoch().count());
+		const auto detected = wait_for(poll, k, true, out.polls[j]);
+
+		const auto release = std::chrono::high_resolution_clock::now();
+
+		write_key(key, LOW);
+		if (g_flight) {
+			g_flight->record(flight_kind::write, release, key.pin, LOW);
+		}
+		std::uint32_t release_polls;
+		const auto released = wait_for(poll, k, false, release_polls);
+		PROBE(release, i, k, release.time_since_epoch().count(), released.time.time_since_epoch().count());
+
+		out.key[j] = k;
+		out.flags[j] = detected.kernel ? trial_flags::kernel_time : 0;
+		out.time[j] = std::chrono::duration_cast<std::chrono::nanoseconds>(detected.time - start);
+		out.released[j] = std::chrono::duration_cast<std::chrono::nanoseconds>(released.time - release);
+		out.planned[j] = delay;
+		out.slept[j] = std::chrono::duration_cast<std::chrono::nanoseconds>(start - sleep_start);
+		out.press[j] = std::chrono::duration_cast<std::chrono::nanoseconds>(start.time_since_epoch());
+		out.release[j] = std::chrono::duration_cast<std::chrono::nanoseconds>(release.time_since_epoch());
+		out.kernel[j] = detected.kernel.value_or(std::chrono::nanoseconds(0));
+
+		if (g_flight && out.time[j] > config.flight_threshold) {
+			g_flight->dump("outlier", previous_start, out.time[j]);
+		}
+		previous_start = sleep_start;
+
+		if (g_live_trials && !store) {
+			print_trial(std::cout, out, j);
+		}
+
+		if (cusum) {
+			if (i == 0) {
+				first_press = out.press[j];
+			}
+
+			if (const auto change = cusum->update(out.time[j].count(), out.press[j])) {
+				print_change(change->index, change->at - first_press, static_cast<long long>(change->before), static_cast<long long>(change->after));
+			}
+		}
+
+		if (metrics) {
+			metrics->publish(out.time[j], out.planned[j], out.slept[j], out.polls[j]);
+		}
+
+		if (feed) {
+			feed->publish(out, j);
+		}
+
+		if (store) {
+			store->commit(i + 1);
+
+			if (i >= config.warmup_count) {
+				g_store_summary[config.keys[out.key[j]].device].add(out.time[j]);
+			}
+		}
+	}
+
+	if (tracer) {
+		g_kernel_trace = tracer->stop();
+	}
+
+	if (probe) {
+		g_jitter_during = probe->stop();
+	}
+
+	if (load) {
+		g_load_rates = load->stop();
+	}
+
+	return trials;
+}
+
+template <typename P>
+std::vector<sequence_trial> measure_sequence(P poll) {
+	prepare_run();
+
+	auto delays = get_delays();
+
+	std::size_t num_edges = 0;
+	for (const auto& step : config.steps) {
+		if (step.type == sequence_step::kind::write) {
+			num_edges += step.keys.size();
+		}
+	}
+
+	std::vector<sequence_trial> trials(config.iterations);
+	std::vector<detection> edges(num_edges);
+
+	for (int i = 0; i < config.iterations; ++i) {
+		auto& trial = trials[i];
+		trial.edges.assign(num_edges, {});
+
+		std::size_t written = 0;
+		std::chrono::high_resolution_clock::time_point trial_start;
+
+		const auto all_seen = [&]() {
+			return std::all_of(std::begin(trial.edges), std::begin(trial.edges) + written, [](const auto& e) { return e.has_value(); });
+		};
+
+		// Writes go out on schedule whether or not earlier edges have been seen
+		// yet, so short taps are really short. Detections are matched to the
+		// oldest outstanding write of the same key and direction. A sync that
+		// times out dumps the flight recorder, like wait_timeout.
+		const auto drain = [&](const std::chrono::high_resolution_clock::time_point deadline, const bool sync) {
+			detection d;
+
+			while (std::chrono::high_resolution_clock::now() < deadline) {
+				if (sync && all_seen()) {
+					return;
+				}
+
+				if (!poll(d)) {
+					continue;
+				}
+
+				std::size_t e = 0;
+				for (; e < written; ++e) {
+					if (!trial.edges[e] && edges[e].key == d.key && edges[e].pressed == d.pressed && edges[e].time <= d.time) {
+						trial.edges[e] = std::chrono::duration_cast<std::chrono::nanoseconds>(d.time - edges[e].time);
+						if (g_flight) {
+							g_flight->record(flight_kind::detect, d.time, d.key, d.pressed);
+						}
+						break;
+					}
+				}
+
+				if (e == written) {
+					++trial.unexpected;
+				}
+			}
+
+			if (sync && g_flight && !all_seen()) {
+				g_flight->dump("timeout", trial_start);
+			}
+		};
+
+		if (g_flight) {
+			g_flight->trial(i);
+		}
+
+		std::this_thread::sleep_for(delays[i]);
+		trial_start = std::chrono::high_resolution_clock::now();
+
+		// Late edges from the previous trial would otherwise be matched
+		// against this trial's writes.
+		detection d;
+		while (poll(d)) {
+		}
+
+		for (const auto& step : config.steps) {
+			switch (step.type) {
+				case sequence_step::kind::write:
+					for (const auto k : step.keys) {
+						edges[written] = { k, step.pressed, std::chrono::high_resolution_clock::now() };
+						write_key(config.keys[k], step.pressed ? HIGH : LOW);
+						if (g_flight) {
+							g_flight->record(flight_kind::write, edges[written].time, config.keys[k].pin, step.pressed ? HIGH : LOW);
+						}
+						++written;
+					}
+					break;
+
+				case sequence_step::kind::wait:
+					drain(std::chrono::high_resolution_clock::now() + step.duration, false);
+					break;
+
+				case sequence_step::kind::sync:
+					drain(std::chrono::high_resolution_clock::now() + std::chrono::microseconds(config.timeout), true);
+					break;
+			}
+		}
+
+		if (g_live_trials) {
+			print_sequence_trial(std::cout, trial);
+		}
+	}
+
+	return trials;
+}
+
+// Holds the key down for `width` and returns how long it actually was. A pin
+// detector is polled throughout: the pin follows the output directly, so a
+// short pulse is over before anything polled afterwards could see it. A pin
+// read is a memory access; evdev reads are syscalls and would stretch the
+// pulse, so other detectors are only polled once it's over. Edges of key 0
+// seen meanwhile are reported in `pressed` and `released`.
+template <typename P>
+std::chrono::nanoseconds pulse(P& poll, const key_binding& key, const std::chrono::nanoseconds width, bool& pressed, bool& released) {
+	// Busy-wait instead of sleep_for; the scheduler can't give us anything
+	// near sub-microsecond resolution.
+	const auto start = std::chrono::high_resolution_clock::now();
+	write_key(key, HIGH);
+
+	detection d;
+	auto end = start;
+	for (;;) {
+		end = std::chrono::high_resolution_clock::now();
+		if (end - start >= width) {
+			break;
+		}
+
+		if (config.pin && poll(d) && d.key == 0) {
+			(d.pressed ? pressed : released) = true;
+		}
+	}
+
+	write_key(key, LOW);
+
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
+}
+
+template <typename P>
+std::vector<pulse_result> measure_pulse(P poll) {
+	prepare_run();
+
+	auto delays = get_delays();
+	const auto& key = config.keys[0];
+
+	std::vector<pulse_result> results;
+
+	const auto test = [&](const std::chrono::nanoseconds width) {
+		pulse_result result { width, {}, 0, config.iterations };
+
+		for (int i = 0; i < config.iterations; ++i) {
+			std::this_thread::sleep_for(delays[i]);
+
+			// Drop anything left over from the previous pulse.
+			detection d;
+			while (poll(d)) {
+			}
+
+			bool pressed = false;
+			bool released = false;
+			result.actual += pulse(poll, key, width, pressed, released) / config.iterations;
+
+			if (pressed || wait_timeout(poll, 0, true)) {
+				++result.detected;
+				if (!released) {
+					wait_timeout(poll, 0, false);
+				}
+			}
+		}
+
+		results.push_back(result);
+
+		if (g_live_trials) {
+			print_pulse_result(std::cout, result);
+		}
+
+		return result.detected * 2 >= result.reps;
+	};
+
+	// Binary search for the shortest width detected at least half the time.
+	auto lo = config.pulse_min;
+	auto hi = config.pulse_max;
+
+	if (test(hi) && !test(lo)) {
+		while (hi - lo > config.pulse_resolution) {
+			const auto mid = lo + (hi - lo) / 2;
+
+			if (test(mid)) {
+				hi = mid;
+			} else {
+				lo = mid;
+			}
+		}
+	}
+
+	std::sort(std::begin(results), std::end(results), [](const auto& a, const auto& b) { return a.width < b.width; });
+
+	return results;
+}
+
+template <typename P>
+std::vector<idle_result> measure_idle(P poll) {
+	prepare_run();
+
+	const auto& key = config.keys[0];
+	std::vector<idle_result> results;
+
+	for (const auto idle : config.idle_steps) {
+		for (int i = 0; i < config.iterations; ++i) {
+			std::this_thread::sleep_for(idle);
+
+			detection d;
+			while (poll(d)) {
+			}
+
+			idle_result result { idle, {} };
+
+			auto start = std::chrono::high_resolution_clock::now();
+			write_key(key, HIGH);
+
+			if (const auto detected = wait_timeout(poll, 0, true)) {
+				result.time = std::chrono::duration_cast<std::chrono::nanoseconds>(*detected - start);
+			}
+
+			write_key(key, LOW);
+			wait_timeout(poll, 0, false);
+
+			results.push_back(result);
+
+			if (g_live_trials) {
+				print_idle_result(std::cout, result);
+			}
+		}
+	}
+
+	return results;
+}
+
+// The sysfs directory of the USB device behind an evdev node, if any.
+std::optional<std::string> usb_device_dir(const int event_id) {
+	std::ostringstream ss;
+	ss << "/sys/class/input/event" << event_id << "/device";
+
+	char* resolved = realpath(ss.str().c_str(), nullptr);
+	if (!resolved) {
+		return {};
+	}
+
+	std::string dir(resolved);
+	free(resolved);
+
+	while (dir.size() > 1) {
+		if (std::ifstream(dir + "/idVendor")) {
+			return dir;
+		}
+
+		dir = dir.substr(0, dir.rfind('/'));
+	}
+
+	return {};
+}
+
+class Autosuspend {
+	public:
+
+	// Finds the USB device behind an evdev node and forces its runtime PM
+	// setting, restoring the original on destruction, at exit or on a
+	// terminating signal.
+	Autosuspend(const int event_id, const bool enable) {
+		const auto dir = usb_device_dir(event_id);
+
+		if (!dir || !std::ifstream(*dir + "/power/control")) {
+			throw std::runtime_error("no usb power control for event " + std::to_string(event_id));
+		}
+
+		_path = *dir + "/power/control";
+
+		std::ifstream(_path) >> _original;
+
+		auto slot = std::find_if(std::begin(g_autosuspend), std::end(g_autosuspend), [](const auto& r) { return !r.active; });
+		if (slot == std::end(g_autosuspend) || _original.empty() || _path.size() >= sizeof(slot->path) || _original.size() + 1 >= sizeof(slot->value)) {
+			throw std::runtime_error("could not save " + _path);
+		}
+
+		hook_restore_host();
+
+		std::strcpy(slot->path, _path.c_str());
+		std::strcpy(slot->value, (_original + "\n").c_str());
+		slot->active = 1;
+		_slot = slot;
+
+		write(enable ? "auto" : "on");
+	}
+
+	~Autosuspend() {
+		if (!_slot || !_slot->active) {
+			return;
+		}
+
+		try {
+			write(_original);
+		} catch (const std::runtime_error& e) {
+			std::cerr << "Could not restore autosuspend: " << e.what() << std::endl;
+		}
+
+		_slot->active = 0;
+	}
+
+	private:
+	void write(const std::string& value) {
+		std::ofstream control(_path);
+		control << value << std::endl;
+
+		if (!control) {
+			throw std::runtime_error("could not write " + _path);
+		}
+	}
+
+	std::string _path;
+	std::string _original;
+	autosuspend_restore* _slot = nullptr;
+};
+
+template <typename F>
+auto measure_usb(const int event_id, F run) {
+	try {
+		Event event(event_id);
+
+		auto fd = event.fd();
+
+		// Keep loopback key presses away from whatever else is listening.
+		if (config.uinput) {
+			ioctl(fd, EVIOCGRAB, 1);
+		}
+
+		// The second device of an A/B run, polled alongside the first.
+		std::optional<Event> event_b;
+		if (config.ab_event) {
+			event_b.emplace(*config.ab_event);
+		}
+
+		std::optional<Autosuspend> autosuspend, autosuspend_b;
+		if (config.autosuspend) {
+			try {
+				autosuspend.emplace(event_id, *config.autosuspend);
+				if (config.ab_event) {
+					autosuspend_b.emplace(*config.ab_event, *config.autosuspend);
+				}
+			} catch (const std::runtime_error& e) {
+				// Put device A back through its destructor before leaving.
+				autosuspend.reset();
+				std::cerr << "Could not set autosuspend: " << e.what() << std::endl;
+				exit(1);
+			}
+		}
+
+		const auto read_event = [&](const int fd, const int device, detection& d) {
+			input_event keyboard_event;
+
+			int ret = read(fd, &keyboard_event, sizeof(input_event));
+
+			if (ret == -1) {
+				return false;
+			}
+
+			d.time = std::chrono::high_resolution_clock::now();
+			d.kernel = std::chrono::seconds(keyboard_event.time.tv_sec) + std::chrono::microseconds(keyboard_event.time.tv_usec);
+			if (g_flight) {
+				g_flight->record(flight_kind::evdev, d.time, keyboard_event.code, keyboard_event.value, *d.kernel);
+			}
+
+			// Ignore autorepeat (value 2).
+			if (keyboard_event.type != EV_KEY || keyboard_event.value > 1) {
+				return false;
+			}
+
+			for (std::size_t k = 0; k < config.keys.size(); ++k) {
+				if (keyboard_event.code == config.keys[k].code && config.keys[k].device == device) {
+					d.key = k;
+					d.pressed = keyboard_event.value == 1;
+					return true;
+				}
+			}
+
+			return false;
+		};
+
+		if (!event_b) {
+			return run([&](detection& d) {
+				return read_event(fd, 0, d);
+			});
+		}
+
+		// Which device is read first alternates from poll to poll, so
+		// neither one's detections wait behind a read of the other more
+		// often.
+		bool b_first = false;
+		return run([&](detection& d) {
+			b_first = !b_first;
+
+			if (b_first) {
+				return read_event(event_b->fd(), 1, d) || read_event(fd, 0, d);
+			}
+			return read_event(fd, 0, d) || read_event(event_b->fd(), 1, d);
+		});
+	} catch (const Event::OpenException&) {
+		std::cerr << "Could not open fd for " << event_id;
+		if (config.ab_event) {
+			std::cerr << " or " << *config.ab_event;
+		}
+		std::cerr << std::endl;
+		exit(1);
+	}
+}
+
+template <typename F>
+auto measure_pin(F run) {
+	// The input is pulled up, so it idles high.
+	int level = HIGH;
+
+	return run([&](detection& d) {
+		const auto read = digitalRead(g_pin_input);
+
+		if (read == level) {
+			return false;
+		}
+
+		level = read;
+
+		d.time = std::chrono::high_resolution_clock::now();
+		if (g_flight) {
+			g_flight->record(flight_kind::pin, d.time, g_pin_input, read);
+		}
+		d.key = 0;
+		d.pressed = read == LOW;
+
+		return true;
+	});
+}
+
+// Creates a virtual keyboard, presses its keys through uinput and detects
+// them on its evdev node like a usb run. This exercises the kernel's input
+// path without any hardware.
+template <typename F>
+auto measure_uinput(F run) {
+	const int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+
+	if (fd < 0) {
+		std::cerr << "Could not open /dev/uinput: " << std::strerror(errno) << std::endl;
+		exit(1);
+	}
+
+	ioctl(fd, UI_SET_EVBIT, EV_KEY);
+	for (const auto& key : config.keys) {
+		ioctl(fd, UI_SET_KEYBIT, key.code);
+	}
+
+	uinput_setup setup = {};
+	setup.id.bustype = BUS_VIRTUAL;
+	std::strncpy(setup.name, "measure-input-latency loopback", UINPUT_MAX_NAME_SIZE - 1);
+
+	char sysname[64] = "";
+	if (ioctl(fd, UI_DEV_SETUP, &setup) < 0 || ioctl(fd, UI_DEV_CREATE) < 0 ||
+			ioctl(fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0) {
+		std::cerr << "Could not create uinput device: " << std::strerror(errno) << std::endl;
+		exit(1);
+	}
+
+	std::optional<int> event_id;
+	const auto dir = std::string("/sys/devices/virtual/input/") + sysname;
+	for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+		const auto name = entry.path().filename().string();
+		if (name.rfind("event", 0) == 0) {
+			event_id = std::stoi(name.substr(5));
+		}
+	}
+
+	if (!event_id) {
+		std::cerr << "No evdev node for " << dir << std::endl;
+		exit(1);
+	}
+
+	// udev may still be creating the device node.
+	const auto node = "/dev/input/event" + std::to_string(*event_id);
+	for (int i = 0; i < 100 && access(node.c_str(), R_OK) != 0; ++i) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	g_uinput = fd;
+	auto ret = measure_usb(*event_id, run);
+	g_uinput = -1;
+
+	ioctl(fd, UI_DEV_DESTROY);
+	close(fd);
+
+	return ret;
+}
+
+template <typename F>
+auto with_detector(F run) {
+	if (config.pin) {
+		return measure_pin(run);
+	}
+
+	if (config.uinput) {
+		return measure_uinput(run);
+	}
+
+	return measure_usb(*config.usb, run);
+}
+
+template <typename T>
+void print_key_summary(T& trials, const std::size_t first) {
+	std::vector<latencies<T>> times(config.keys.size());
+	for_each_trial(trials, [&](const trial_records& r, const std::size_t j, const std::size_t i) {
+		if (i >= first) {
+			collect(times[r.key[j]], r.time[j]);
+		}
+	});
+
+	std::vector<summary> summaries;
+
+	for (std::size_t k = 0; k < config.keys.size(); ++k) {
+		summaries.push_back(summarize(times[k]));
+
+		// Archives don't record pins.
+		std::cout << "{\"key\":" << config.keys[k].code << ","
+		          << (config.keymap ? "\"pin\":" + std::to_string(config.keys[k].pin) + "," : "")
+		          << (has_ab_keys() ? "\"device\":" + std::to_string(config.keys[k].device) + "," : "")
+		          << summary_json(summaries.back()) << "}" << std::endl;
+	}
+
+	// Lay the per-key medians out over the keyboard, so keys late in the
+	// matrix scan stand out.
+	int rows = 0;
+	int cols = 0;
+	for (const auto& key : config.keys) {
+		if (key.row && key.col) {
+			rows = std::max(rows, *key.row + 1);
+			cols = std::max(cols, *key.col + 1);
+		}
+	}
+
+	if (rows == 0) {
+		return;
+	}
+
+	std::vector<std::vector<std::optional<long long>>> grid(rows, std::vector<std::optional<long long>>(cols));
+	for (std::size_t k = 0; k < config.keys.size(); ++k) {
+		const auto& key = config.keys[k];
+		if (key.row && key.col && summaries[k].count > 0) {
+			grid[*key.row][*key.col] = summaries[k].median.count();
+		}
+	}
+
+	std::cout << "{\"heatmap\":[";
+	for (int r = 0; r < rows; ++r) {
+		std::cout << (r ? "," : "") << "[";
+		for (int c = 0; c < cols; ++c) {
+			std::cout << (c ? "," : "");
+			if (grid[r][c]) {
+				std::cout << *grid[r][c];
+			} else {
+				std::cout << "null";
+			}
+		}
+		std::cout << "]";
+	}
+	std::cout << "]}" << std::endl;
+}
+
+std::size_t find_warmup(const std::vector<std::chrono::nanoseconds>& times) {
+	if (!config.warmup_auto) {
+		return std::min(times.size(), static_cast<std::size_t>(config.warmup_count));
+	}
+
+	const auto median_of = [](std::vector<std::chrono::nanoseconds> v) {
+		std::nth_element(std::begin(v), std::begin(v) + v.size() / 2, std::end(v));
+		return v[v.size() / 2];
+	};
+
+	// The second half of the run is taken as steady state. The transient ends
+	// at the first window whose median is within three standard errors of the
+	// steady-state median, with the spread estimated from the MAD.
+	const std::size_t window = std::max<std::size_t>(10, times.size() / 50);
+	if (times.size() < window * 4) {
+		return std::min(times.size(), static_cast<std::size_t>(config.warmup_count));
+	}
+
+	std::vector<std::chrono::nanoseconds> steady(std::begin(times) + times.size() / 2, std::end(times));
+	const auto center = median_of(steady);
+	for (auto& t : steady) {
+		t = t > center ? t - center : center - t;
+	}
+	const auto mad = median_of(steady);
+
+	const double tolerance = std::max(1.0, 3 * 1.253 * 1.4826 * mad.count() / std::sqrt(window));
+
+	for (std::size_t i = 0; i + window <= times.size() / 2; i += window / 2) {
+		const auto m = median_of(std::vector<std::chrono::nanoseconds>(std::begin(times) + i, std::begin(times) + i + window));
+
+		if (std::abs(static_cast<double>((m - center).count())) <= tolerance) {
+			return i;
+		}
+	}
+
+	// Never converged; fall back to the fixed count.
+	return std::min(times.size(), static_cast<std::size_t>(config.warmup_count));
+}
+
+std::size_t find_warmup(const trial_records& trials) {
+	return find_warmup(std::vector<std::chrono::nanoseconds>(std::begin(trials.time), std::end(trials.time)));
+}
+
+// Auto detection needs every latency at once, so stores only skip the
+// fixed --warmup count.
+std::size_t find_warmup(const StoreView& store) {
+	return std::min(store.size(), static_cast<std::size_t>(config.warmup_count));
+}
+
+template <typename T>
+void print_drift(T& trials) {
+	if (trials.size() == 0) {
+		return;
+	}
+
+	// A live run has already reported its changes.
+	if (!g_drift_live) {
+		Cusum cusum(*config.drift, config.drift_arl);
+
+		std::vector<std::size_t> changes;
+		std::vector<std::chrono::nanoseconds> at;
+		std::chrono::nanoseconds first_press = {};
+		for_each_trial(trials, [&](const trial_records& r, const std::size_t j, const std::size_t i) {
+			if (i == 0) {
+				first_press = r.press[j];
+			}
+
+			if (const auto change = cusum.update(r.time[j].count(), r.press[j])) {
+				changes.push_back(change->index);
+				at.push_back(change->at);
+			}
+		});
+
+		// Means of the stretches between changes.
+		std::vector<double> sums(changes.size() + 1);
+		std::size_t segment = 0;
+		for_each_trial(trials, [&](const trial_records& r, const std::size_t j, const std::size_t i) {
+			while (segment < changes.size() && i >= changes[segment]) {
+				++segment;
+			}
+			sums[segment] += r.time[j].count();
+		});
+
+		const auto mean = [&](const std::size_t s) {
+			const auto begin = s ? changes[s - 1] : 0;
+			const auto end = s < changes.size() ? changes[s] : trials.size();
+			return static_cast<long long>(sums[s] / (end - begin));
+		};
+
+		for (std::size_t c = 0; c < changes.size(); ++c) {
+			print_change(changes[c], at[c] - first_press, mean(c), mean(c + 1));
+		}
+	}
+
+	// Time x latency histogram. Latency bins cover min..p99, with everything
+	// above p99 in the last bin.
+	const std::size_t time_bins = 20;
+	const std::size_t latency_bins = 20;
+
+	// Time bins span the earliest to the latest press rather than the first
+	// to the last, so edited or merged files with out-of-order presses still
+	// land in range.
+	latencies<T> times;
+	auto first = std::chrono::nanoseconds::max();
+	auto last = std::chrono::nanoseconds::min();
+	for_each_trial(trials, [&](const trial_records& r, const std::size_t j, std::size_t) {
+		collect(times, r.time[j]);
+		first = std::min(first, r.press[j]);
+		last = std::max(last, r.press[j]);
+	});
+
+	const auto s = summarize(times);
+	const auto duration = (last - first).count() + 1;
+	const auto width = std::max<long long>(1, (s.p99 - s.min).count() / (latency_bins - 1));
+
+	std::vector<std::vector<std::size_t>> counts(time_bins, std::vector<std::size_t>(latency_bins));
+	for_each_trial(trials, [&](const trial_records& r, const std::size_t j, std::size_t) {
+		const auto tb = std::min(time_bins - 1, static_cast<std::size_t>(static_cast<double>((r.press[j] - first).count()) * time_bins / duration));
+		const auto lb = std::min(latency_bins - 1, static_cast<std::size_t>((r.time[j] - s.min).count() / width));
+		++counts[tb][lb];
+	});
+
+	std::cout << "{\"drift_heatmap\":{\"time_bin\":" << duration / time_bins << ","
+	          << "\"latency_min\":" << s.min.count() << ","
+	          << "\"latency_bin\":" << width << ","
+	          << "\"counts\":[";
+	for (std::size_t tb = 0; tb < time_bins; ++tb) {
+		std::cout << (tb ? "," : "") << "[";
+		for (std::size_t lb = 0; lb < latency_bins; ++lb) {
+			std::cout << (lb ? "," : "") << counts[tb][lb];
+		}
+		std::cout << "]";
+	}
+	std::cout << "]}}" << std::endl;
+}
+
+template <typename T>
+void print_phase(T& trials, const std::size_t first) {
+	const std::size_t bins = 16;
+
+	// Fold press times over each candidate period and see how much of the
+	// latency variance the phase explains (eta squared). Structure shows up
+	// as peaks, including aliases of our own delay schedule.
+	const auto n = trials.size() - first;
+	if (n == 0) {
+		return;
+	}
+
+	double mean = 0;
+	std::chrono::nanoseconds origin = {};
+	for_each_trial(trials, [&](const trial_records& r, const std::size_t j, const std::size_t i) {
+		if (i == first) {
+			origin = r.press[j];
+		}
+		if (i >= first) {
+			mean += static_cast<double>(r.time[j].count()) / n;
+		}
+	});
+
+	std::vector<std::chrono::nanoseconds> periods;
+	for (auto period = config.phase_min; period <= config.phase_max; period += config.phase_step) {
+		periods.push_back(period);
+	}
+
+	std::optional<std::pair<long long, double>> best;
+
+	// Periods are folded a batch per pass over the trials, which bounds the
+	// bins held at once.
+	const std::size_t batch = 256;
+	for (std::size_t p0 = 0; p0 < periods.size(); p0 += batch) {
+		const auto p1 = std::min(periods.size(), p0 + batch);
+		std::vector<double> sums((p1 - p0) * bins);
+		std::vector<std::size_t> counts((p1 - p0) * bins);
+		double total = 0;
+
+		for_each_trial(trials, [&](const trial_records& r, const std::size_t j, const std::size_t i) {
+			if (i < first) {
+				return;
+			}
+
+			const double d = r.time[j].count() - mean;
+			total += d * d;
+
+			for (auto p = p0; p < p1; ++p) {
+				// Presses before the first one (out-of-order input) fold onto
+				// the same cycle instead of giving a negative phase.
+				auto phase = (r.press[j] - origin) % periods[p];
+				if (phase.count() < 0) {
+					phase += periods[p];
+				}
+				const auto b = (p - p0) * bins + static_cast<std::size_t>(phase * bins / periods[p]);
+				sums[b] += r.time[j].count();
+				++counts[b];
+			}
+		});
+
+		if (total == 0) {
+			return;
+		}
+
+		for (auto p = p0; p < p1; ++p) {
+			double between = 0;
+			double lo = std::numeric_limits<double>::infinity();
+			double hi = -lo;
+			for (auto b = (p - p0) * bins; b < (p - p0 + 1) * bins; ++b) {
+				if (counts[b] == 0) {
+					continue;
+				}
+
+				const double m = sums[b] / counts[b];
+				between += counts[b] * (m - mean) * (m - mean);
+				lo = std::min(lo, m);
+				hi = std::max(hi, m);
+			}
+
+			const double strength = between / total;
+			if (!best || strength > best->second) {
+				best = { periods[p].count(), strength };
+			}
+
+			std::cout << "{\"phase\":{\"period\":" << periods[p].count() << ","
+			          << "\"strength\":" << strength << ","
+			          << "\"amplitude\":" << static_cast<long long>(hi - lo) << "}}" << std::endl;
+		}
+	}
+
+	if (best) {
+		std::cout << "{\"phase_best\":{\"period\":" << best->first << ","
+		          << "\"strength\":" << best->second << "}}" << std::endl;
+	}
+}
+
+// Standard normal quantile, by bisection on erfc.
+double normal_quantile(const double p) {
+	double lo = -10, hi = 10;
+	for (int i = 0; i < 100; ++i) {
+		const double mid = (lo + hi) / 2;
+		if (0.5 * std::erfc(-mid / std::sqrt(2.0)) < p) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return (lo + hi) / 2;
+}
+
+struct quantile_bounds {
+	std::chrono::nanoseconds lower;
+	std::chrono::nanoseconds estimate;
+	std::chrono::nanoseconds upper;
+};
+
+// Distribution-free one-sided bounds on the q-quantile from order statistics:
+// the rank of the quantile in the sample is Binomial(n, q), taken as normal.
+// `at` gives the i-th smallest of the n samples.
+template <typename F>
+quantile_bounds quantile_interval(const std::size_t size, const double q, const double confidence, F at) {
+	const auto n = static_cast<double>(size);
+	const double z = normal_quantile(confidence);
+	const double spread = z * std::sqrt(n * q * (1 - q));
+
+	const auto rank = [&](const double r) {
+		return at(static_cast<std::size_t>(std::clamp(r, 1.0, n)) - 1);
+	};
+
+	return { rank(std::floor(n * q - spread)), rank(std::ceil(n * q)), rank(std::ceil(n * q + spread)) };
+}
+
+quantile_bounds quantile_interval(std::vector<std::chrono::nanoseconds>& times, const double q, const double confidence) {
+	return quantile_interval(times.size(), q, confidence, [&](const std::size_t i) {
+		std::nth_element(std::begin(times), std::begin(times) + i, std::end(times));
+		return times[i];
+	});
+}
+
+quantile_bounds quantile_interval(const SignedSummary& diffs, const double q, const double confidence) {
+	return quantile_interval(diffs.size(), q, confidence, [&](const std::size_t i) { return diffs.at(i); });
+}
+
+// Splits each trial's host side using the kernel trace: the timer wakeup
+// ending its sleep, the stimulus to the USB controller's interrupt, time in
+// that handler and in softirqs on our thread's CPU, and time our thread was
+// switched out while waiting for the detection.
+template <typename T>
+void print_host_attribution(T& trials, const std::size_t first, const kernel_trace& trace) {
+	latencies<T> wakeup, irq_delay, irq_handler, softirq, preempted;
+	const auto& events = trace.events;
+
+	for_each_trial(trials, [&](const trial_records& r, const std::size_t j, const std::size_t i) {
+		if (i < first) {
+			return;
+		}
+
+		const auto press = r.press[j].count() - trace.offset;
+		const auto sleep_start = press - r.slept[j].count();
+		const auto detect = press + r.time[j].count();
+
+		auto it = std::lower_bound(std::begin(events), std::end(events), sleep_start, [](const auto& e, const auto t) { return e.time < t; });
+
+		// Monotonic times are positive, so -1 is "not seen".
+		std::int64_t woken = -1, woke = -1;
+		std::optional<std::int64_t> irq;
+		std::int64_t irq_time = 0, softirq_time = 0, out_time = 0;
+		std::map<std::uint16_t, std::int64_t> irq_entry;
+		std::int64_t softirq_entry = -1, switched_out = -1;
+
+		// The CPU our thread last ran on, from its own switches. Softirqs
+		// elsewhere don't delay it.
+		std::optional<std::uint16_t> cpu;
+		if (config.cpu) {
+			cpu = *config.cpu;
+		}
+
+		for (; it != std::end(events) && it->time <= detect; ++it) {
+			const auto t = it->time;
+
+			if ((it->kind == kernel_kind::switch_in || it->kind == kernel_kind::switch_out) && cpu != it->cpu) {
+				cpu = it->cpu;
+				softirq_entry = -1;
+			}
+
+			if (t < press) {
+				if (it->kind == kernel_kind::wakeup) {
+					woken = t;
+					woke = -1;
+				} else if (it->kind == kernel_kind::switch_in && woken >= 0 && woke < 0) {
+					woke = t;
+				}
+				continue;
+			}
+
+			switch (it->kind) {
+				case kernel_kind::irq_entry:
+					irq = irq.value_or(t);
+					irq_entry[it->cpu] = t;
+					break;
+				case kernel_kind::irq_exit:
+					if (irq_entry.count(it->cpu)) {
+						irq_time += t - irq_entry[it->cpu];
+						irq_entry.erase(it->cpu);
+					}
+					break;
+				case kernel_kind::softirq_entry:
+					if (!cpu || it->cpu == *cpu) {
+						softirq_entry = t;
+					}
+					break;
+				case kernel_kind::softirq_exit:
+					if (softirq_entry >= 0 && (!cpu || it->cpu == *cpu)) {
+						softirq_time += t - softirq_entry;
+						softirq_entry = -1;
+					}
+					break;
+				case kernel_kind::switch_out:
+					switched_out = t;
+					break;
+				case kernel_kind::switch_in:
+					if (switched_out >= 0) {
+						out_time += t - switched_out;
+						switched_out = -1;
+					}
+					break;
+				default:
+					break;
+			}
+		}
+
+		if (switched_out >= 0) {
+			out_time += detect - switched_out;
+		}
+
+		if (woke >= 0) {
+			collect(wakeup, std::chrono::nanoseconds(woke - woken));
+		}
+		if (irq) {
+			collect(irq_delay, std::chrono::nanoseconds(*irq - press));
+			collect(irq_handler, std::chrono::nanoseconds(irq_time));
+		}
+		collect(softirq, std::chrono::nanoseconds(softirq_time));
+		collect(preempted, std::chrono::nanoseconds(out_time));
+	});
+
+	std::cout << "{\"host\":{\"events\":" << events.size() << ","
+	          << "\"lost_pages\":" << trace.lost_pages << ","
+	          << "\"wakeup\":{" << summary_json(summarize(wakeup)) << "},"
+	          << "\"irq_delay\":{" << summary_json(summarize(irq_delay)) << "},"
+	          << "\"irq_handler\":{" << summary_json(summarize(irq_handler)) << "},"
+	          << "\"softirq\":{" << summary_json(summarize(softirq)) << "},"
+	          << "\"preempted\":{" << summary_json(summarize(preempted)) << "}}}" << std::endl;
+}
+
+// A and B trials are paired in order; balanced blocks keep each pair a few
+// trials apart, so host drift cancels out of the differences.
+template <typename T>
+void print_ab(T& trials, const std::size_t first) {
+	latencies<T> a, b;
+	latency_diffs<T> diffs;
+	std::size_t wins = 0;
+	std::size_t ties = 0;
+	double sum = 0;
+
+	// Latencies of whichever device is ahead, waiting for their pair.
+	std::deque<std::chrono::nanoseconds> waiting;
+	int ahead = 0;
+
+	for_each_trial(trials, [&](const trial_records& r, const std::size_t j, const std::size_t i) {
+		if (i < first) {
+			return;
+		}
+
+		const auto device = config.keys[r.key[j]].device;
+		collect(device == 0 ? a : b, r.time[j]);
+
+		if (waiting.empty() || device == ahead) {
+			ahead = device;
+			waiting.push_back(r.time[j]);
+			return;
+		}
+
+		const auto d = device == 1 ? r.time[j] - waiting.front() : waiting.front() - r.time[j];
+		waiting.pop_front();
+
+		collect(diffs, d);
+		wins += d.count() > 0;
+		ties += d.count() == 0;
+		sum += d.count();
+	});
+
+	if (diffs.size() == 0) {
+		return;
+	}
+
+	const auto mean = sum / diffs.size();
+	const auto median = quantile_interval(diffs, 0.5, 0.975);
+
+	std::cout << "{\"ab\":{\"a\":{" << summary_json(summarize(a)) << "},"
+	          << "\"b\":{" << summary_json(summarize(b)) << "},"
+	          << "\"pairs\":" << diffs.size() << ","
+	          << "\"median_diff\":" << median.estimate.count() << ","
+	          << "\"median_diff_ci\":[" << median.lower.count() << "," << median.upper.count() << "],"
+	          << "\"mean_diff\":" << static_cast<long long>(mean) << ","
+	          << "\"p_b_slower\":" << (wins + ties / 2.0) / diffs.size() << "}}" << std::endl;
+}
+
+// Latencies of trials [first, last) on `device`.
+std::vector<std::chrono::nanoseconds> device_times(const trial_records& trials, const int device, const std::size_t first, const std::size_t last) {
+	std::vector<std::chrono::nanoseconds> ret;
+	for (std::size_t i = first; i < last; ++i) {
+		if (config.keys[trials.key[i]].device == device) {
+			ret.push_back(trials.time[i]);
+		}
+	}
+
+	return ret;
+}
+
+template <typename T>
+void print_summary(T& trials) {
+	// Warm-up trials are reported on their own and left out of everything else.
+	const auto warmup = find_warmup(trials);
+
+	// A and B are different devices, so they're never summarized together.
+	latencies<T> warmup_times[2], steady_times[2];
+	for_each_trial(trials, [&](const trial_records& r, const std::size_t j, const std::size_t i) {
+		collect((i < warmup ? warmup_times : steady_times)[config.keys[r.key[j]].device], r.time[j]);
+	});
+
+	if (has_ab_keys()) {
+		for (const int device : { 0, 1 }) {
+			std::cout << "{\"warmup\":{\"device\":" << device << "," << summary_json(summarize(warmup_times[device])) << "}}" << std::endl;
+			std::cout << "{\"summary\":{\"device\":" << device << "," << summary_json(summarize(steady_times[device])) << "}}" << std::endl;
+		}
+	} else {
+		std::cout << "{\"warmup\":{" << summary_json(summarize(warmup_times[0])) << "}}" << std::endl;
+		std::cout << "{\"summary\":{" << summary_json(summarize(steady_times[0])) << "}}" << std::endl;
+	}
+
+	if (has_keymap_keys()) {
+		print_key_summary(trials, warmup);
+	}
+
+	if (has_ab_keys()) {
+		print_ab(trials, warmup);
+	}
+
+	if (g_kernel_trace) {
+		print_host_attribution(trials, warmup, *g_kernel_trace);
+	}
+
+	if (!g_load_rates.empty()) {
+		std::cout << "{\"load\":[";
+		for (std::size_t i = 0; i < config.load.size(); ++i) {
+			const auto& l = config.load[i];
+			std::cout << (i ? "," : "") << "{\"kind\":" << json_string(l.kind) << ","
+			          << "\"threads\":" << l.threads << ","
+			          << "\"intensity\":" << l.intensity << ","
+			          << "\"cpus\":[";
+			for (std::size_t c = 0; c < l.cpus.size(); ++c) {
+				std::cout << (c ? "," : "") << l.cpus[c];
+			}
+			std::cout << "],\"ops_per_s\":" << static_cast<long long>(g_load_rates[i]) << "}";
+		}
+		std::cout << "]}" << std::endl;
+	}
+
+	if (g_jitter_before) {
+		std::cout << "{\"jitter\":{\"before\":{" << summary_json(*g_jitter_before) << "},"
+		          << "\"during\":" << (g_jitter_during ? "{" + summary_json(*g_jitter_during) + "}" : "null") << ","
+		          << "\"rejected\":" << (jitter_rejected() ? "true" : "false") << "}}" << std::endl;
+	}
+
+	if (config.drift) {
+		print_drift(trials);
+	}
+
+	if (config.phase) {
+		print_phase(trials, warmup);
+	}
+}
+
+// Fixed-size index record; the full metadata is a json line in the data
+// file at `offset`. Queries only ever read the index.
+struct catalog_entry {
+	std::int64_t time;
+	std::uint64_t offset;
+	std::uint32_t length;
+	std::uint32_t count;
+	std::uint16_t bustype;
+	std::uint16_t vendor;
+	std::uint16_t product;
+	std::uint16_t version;
+	std::int64_t p50;
+	std::int64_t p90;
+	std::int64_t p99;
+	char firmware[16];
+	char name[48];
+};
+
+std::string catalog_dir() {
+	if (!config.catalog.empty()) {
+		return config.catalog;
+	}
+
+	if (const char* xdg = getenv("XDG_DATA_HOME")) {
+		return std::string(xdg) + "/measure-input-latency";
+	}
+
+	const char* home = getenv("HOME");
+
+	return std::string(home ? home : ".") + "/.local/share/measure-input-latency";
+}
+
+// Adds a run of the device at `event` (if any) with the steady-state
+// summary `s` to the catalog.
+void add_to_catalog(const summary& s, const std::optional<unsigned int> event) {
+	const auto dir = catalog_dir();
+
+	std::error_code error;
+	std::filesystem::create_directories(dir, error);
+
+	catalog_entry entry = {};
+	entry.time = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+	std::string name = config.uinput ? "uinput" : "pin";
+	std::string firmware;
+
+	if (event) {
+		try {
+			const Event device(*event);
+			const auto id = device.device_id();
+
+			name = device.name();
+			entry.bustype = id.bustype;
+			entry.vendor = id.vendor;
+			entry.product = id.product;
+			entry.version = id.version;
+		} catch (const Event::OpenException&) {
+		}
+
+		// bcdDevice is where USB devices report their firmware revision.
+		if (const auto usb = usb_device_dir(*event)) {
+			std::ifstream(*usb + "/bcdDevice") >> firmware;
+		}
+
+		if (firmware.empty()) {
+			std::stringstream ss;
+			ss << std::hex << std::setw(4) << std::setfill('0') << entry.version;
+			firmware = ss.str();
+		}
+	}
+
+	entry.count = s.count;
+	entry.p50 = s.median.count();
+	entry.p90 = s.p90.count();
+	entry.p99 = s.p99.count();
+	// Truncated to fit, and always terminated.
+	std::snprintf(entry.firmware, sizeof(entry.firmware), "%s", firmware.c_str());
+	std::snprintf(entry.name, sizeof(entry.name), "%s", name.c_str());
+
+	utsname host = {};
+	uname(&host);
+
+	std::stringstream line;
+	line << "{\"time\":" << entry.time << ","
+	     << "\"device\":{\"name\":" << json_string(name) << ","
+	     << "\"bustype\":" << entry.bustype << ","
+	     << "\"vendor\":" << entry.vendor << ","
+	     << "\"product\":" << entry.product << ","
+	     << "\"version\":" << entry.version << ","
+	     << "\"firmware\":" << json_string(firmware) << "},"
+	     << "\"host\":{\"name\":" << json_string(host.nodename) << ","
+	     << "\"kernel\":" << json_string(host.release) << ","
+	     << "\"machine\":" << json_string(host.machine) << ","
+	     << "\"jitter_p99\":" << (g_jitter_before ? std::to_string(std::max(g_jitter_before->p99, g_jitter_during.value_or(summary()).p99).count()) : "null") << "},"
+	     << "\"config\":" << config_json() << ","
+	     << "\"samples\":" << (config.store ? json_string(*config.store) : "null") << ","
+	     << "\"summary\":{" << summary_json(s) << "}}" << std::endl;
+	const auto text = line.str();
+
+	const int data_fd = open((dir + "/catalog.dat").c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+	const int index_fd = open((dir + "/catalog.idx").c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+
+	// The index lock keeps concurrent runs from interleaving their entries.
+	if (data_fd < 0 || index_fd < 0 || flock(index_fd, LOCK_EX) != 0) {
+		std::cerr << "Could not update catalog in " << dir << std::endl;
+	} else {
+		entry.offset = lseek(data_fd, 0, SEEK_END);
+		entry.length = text.size();
+
+		if (
+			write(data_fd, text.data(), text.size()) != static_cast<ssize_t>(text.size()) ||
+			write(index_fd, &entry, sizeof(entry)) != static_cast<ssize_t>(sizeof(entry))
+		) {
+			std::cerr << "Could not update catalog in " << dir << std::endl;
+		}
+	}
+
+	if (data_fd >= 0) {
+		close(data_fd);
+	}
+
+	if (index_fd >= 0) {
+		close(index_fd);
+	}
+}
+
+void print_catalog_query(const std::string& filter) {
+	std::optional<int> vendor;
+	std::optional<int> product;
+	std::optional<std::string> firmware;
+	std::optional<std::string> name;
+
+	std::istringstream fs(filter);
+	for (std::string term; std::getline(fs, term, ',');) {
+		const auto eq = term.find('=');
+		const auto field = term.substr(0, eq);
+		const auto value = eq == std::string::npos ? "" : term.substr(eq + 1);
+
+		try {
+			if (field == "vendor") {
+				vendor = std::stoi(value, nullptr, 16);
+			} else if (field == "product") {
+				product = std::stoi(value, nullptr, 16);
+			} else if (field == "firmware") {
+				firmware = value;
+			} else if (field == "name") {
+				name = value;
+			} else if (!field.empty()) {
+				throw std::invalid_argument(field);
+			}
+		} catch (const std::exception&) {
+			std::cerr << "Invalid query term '" << term << "'" << std::endl;
+			exit(1);
+		}
+	}
+
+	std::vector<catalog_entry> entries;
+	try {
+		const MappedFile index(catalog_dir() + "/catalog.idx");
+		entries.resize(index.size() / sizeof(catalog_entry));
+		std::memcpy(entries.data(), index.data(), entries.size() * sizeof(catalog_entry));
+	} catch (const std::runtime_error&) {
+		std::cerr << "No catalog in " << catalog_dir() << std::endl;
+		exit(1);
+	}
+
+	std::map<std::string, std::vector<std::int64_t>> by_firmware;
+
+	for (const auto& e : entries) {
+		const std::string e_name(e.name, strnlen(e.name, sizeof(e.name)));
+		const std::string e_firmware(e.firmware, strnlen(e.firmware, sizeof(e.firmware)));
+
+		if (
+			(vendor && *vendor != e.vendor) ||
+			(product && *product != e.product) ||
+			(firmware && *firmware != e_firmware) ||
+			(name && e_name.find(*name) == std::string::npos)
+		) {
+			continue;
+		}
+
+		std::cout << "{\"run\":{\"time\":" << e.time << ","
+		          << "\"name\":" << json_string(e_name) << ","
+		          << "\"vendor\":" << e.vendor << ","
+		          << "\"product\":" << e.product << ","
+		          << "\"firmware\":" << json_string(e_firmware) << ","
+		          << "\"count\":" << e.count << ","
+		          << "\"p50\":" << e.p50 << ","
+		          << "\"p90\":" << e.p90 << ","
+		          << "\"p99\":" << e.p99 << ","
+		          << "\"offset\":" << e.offset << "}}" << std::endl;
+
+		by_firmware[e_firmware].push_back(e.p99);
+	}
+
+	for (auto& [fw, p99s] : by_firmware) {
+		std::sort(std::begin(p99s), std::end(p99s));
+
+		std::cout << "{\"firmware\":" << json_string(fw) << ","
+		          << "\"runs\":" << p99s.size() << ","
+		          << "\"p99_median\":" << p99s[p99s.size() / 2] << ","
+		          << "\"p99_min\":" << p99s.front() << ","
+		          << "\"p99_max\":" << p99s.back() << "}" << std::endl;
+	}
+}
+
+// Common end of every measurement: fail a run from a noisy host, then add
+// the summary `device_summary(device)` of each device to the catalog.
+template <typename F>
+void finish_run(F device_summary) {
+	// Runs from a noisy host don't go in the catalog.
+	if (jitter_rejected()) {
+		std::cerr << "Host too noisy during the run: wakeup p99 " << g_jitter_during->p99.count() << "ns exceeds --max-jitter" << std::endl;
+		exit(2);
+	}
+
+	if (config.catalog == "none") {
+		return;
+	}
+
+	// A and B each get their own catalog entry.
+	for (const int device : { 0, 1 }) {
+		if (device == 1 && !has_ab_keys()) {
+			break;
+		}
+
+		add_to_catalog(device_summary(device), device == 0 ? config.usb : std::optional<unsigned int>(config.ab_event));
+	}
+}
+
+template <typename F>
+void measure(F measure_fn) {
+	const auto trials = measure_fn();
+
+	std::stringstream tss;
+	for (std::size_t i = 0; i < trials.size() && !config.store && !g_live_trials; ++i) {
+		print_trial(tss, trials, i);
+	}
+	std::cout << tss.str();
+
+	// With a store the trials are only in the file, which the summary reads
+	// a chunk at a time.
+	if (config.summary && config.store) {
+		try {
+			StoreView store(*config.store);
+			print_summary(store);
+		} catch (const std::runtime_error& e) {
+			std::cerr << "Could not read store: " << e.what() << std::endl;
+			exit(1);
+		}
+	} else if (config.summary) {
+		print_summary(trials);
+	}
+
+	const auto warmup = config.store || config.catalog == "none" ? 0 : find_warmup(std::vector<std::chrono::nanoseconds>(std::begin(trials.time), std::end(trials.time)));
+
+	finish_run([&](const int device) {
+		return config.store ? g_store_summary[device].get() : summarize(device_times(trials, device, warmup, trials.size()));
+	});
+}
+
+
+void print_sequence(const std::vector<sequence_trial>& trials) {
+	std::stringstream tss;
+	for (std::size_t i = 0; i < trials.size() && !g_live_trials; ++i) {
+		print_sequence_trial(tss, trials[i]);
+	}
+	std::cout << tss.str();
+
+	if (!config.summary) {
+		return;
+	}
+
+	std::size_t e = 0;
+	for (const auto& step : config.steps) {
+		if (step.type != sequence_step::kind::write) {
+			continue;
+		}
+
+		for (const auto k : step.keys) {
+			std::vector<std::chrono::nanoseconds> times;
+			for (const auto& t : trials) {
+				if (t.edges[e]) {
+					times.push_back(*t.edges[e]);
+				}
+			}
+
+			std::cout << "{\"edge\":" << e << ","
+			          << "\"key\":" << config.keys[k].code << ","
+			          << "\"pressed\":" << (step.pressed ? "true" : "false") << ","
+			          << "\"missed\":" << trials.size() - times.size() << ","
+			          << summary_json(summarize(times)) << "}" << std::endl;
+			++e;
+		}
+	}
+
+	std::size_t unexpected = 0;
+	for (const auto& t : trials) {
+		unexpected += t.unexpected;
+	}
+	std::cout << "{\"unexpected\":" << unexpected << "}" << std::endl;
+}
+
+void print_pulse(const std::vector<pulse_result>& results) {
+	std::stringstream rss;
+	for (std::size_t i = 0; i < results.size() && !g_live_trials; ++i) {
+		print_pulse_result(rss, results[i]);
+	}
+	std::cout << rss.str();
+
+	if (config.summary) {
+		std::optional<long long> threshold;
+		for (const auto& r : results) {
+			if (!threshold && r.detected * 2 >= r.reps) {
+				threshold = r.width.count();
+			}
+		}
+
+		std::cout << "{\"threshold\":" << (threshold ? std::to_string(*threshold) : "null") << "}" << std::endl;
+	}
+}
+
+void print_idle(const std::vector<idle_result>& results) {
+	std::stringstream rss;
+	for (std::size_t i = 0; i < results.size() && !g_live_trials; ++i) {
+		print_idle_result(rss, results[i]);
+	}
+	std::cout << rss.str();
+
+	if (!config.summary) {
+		return;
+	}
+
+	for (const auto idle : config.idle_steps) {
+		std::vector<std::chrono::nanoseconds> times;
+		std::size_t missed = 0;
+		for (const auto& r : results) {
+			if (r.idle != idle) {
+				continue;
+			}
+
+			if (r.time) {
+				times.push_back(*r.time);
+			} else {
+				++missed;
+			}
+		}
+
+		std::cout << "{\"idle\":" << idle.count() << ","
+		          << "\"missed\":" << missed << ","
+		          << summary_json(summarize(times)) << "}" << std::endl;
+	}
+}
+
+struct histogram {
+	double lo;
+	double width;
+	std::vector<double> counts;
+};
+
+histogram make_histogram(const std::vector<std::chrono::nanoseconds>& times, const double lo, const double hi, const std::size_t bins) {
+	histogram ret { lo, (hi - lo) / bins, std::vector<double>(bins) };
+
+	for (const auto& t : times) {
+		const auto b = std::clamp(static_cast<long long>((t.count() - lo) / ret.width), 0LL, static_cast<long long>(bins - 1));
+		ret.counts[b] += 1;
+	}
+
+	return ret;
+}
+
+struct latency_model {
+	double offset;
+	double short_period;
+	double long_period;
+	double loglik;
+};
+
+// CDF of U(0, a) + U(0, b) with a <= b; the density is a trapezoid.
+double uniform_sum_cdf(const double y, const double a, const double b) {
+	if (y <= 0) {
+		return 0;
+	} else if (y <= a) {
+		return y * y / (2 * a * b);
+	} else if (y <= b) {
+		return (y - a / 2) / b;
+	} else if (y < a + b) {
+		return 1 - (a + b - y) * (a + b - y) / (2 * a * b);
+	}
+
+	return 1;
+}
+
+double model_loglik(const histogram& h, const double offset, const double a, const double b) {
+	// A small uniform floor keeps outliers from ruling out a model entirely.
+	const double floor = 0.01;
+	const double floor_mass = floor / h.counts.size();
+
+	double ret = 0;
+	for (std::size_t i = 0; i < h.counts.size(); ++i) {
+		if (h.counts[i] == 0) {
+			continue;
+		}
+
+		const double lo = h.lo + i * h.width - offset;
+		const double mass = (1 - floor) * (uniform_sum_cdf(lo + h.width, a, b) - uniform_sum_cdf(lo, a, b)) + floor_mass;
+		ret += h.counts[i] * std::log(mass);
+	}
+
+	return ret;
+}
+
+// Maximum likelihood fit of offset + U(0, scan) + U(0, poll) by grid search,
+// zooming in on the best cell. The offset axis is split across threads.
+latency_model fit_model(const histogram& h, const unsigned int threads) {
+	const double range = h.width * h.counts.size();
+	const double min_period = h.width / 4;
+	const int grid = 16;
+
+	double offset_lo = h.lo - range / 4;
+	double offset_hi = h.lo + range / 4;
+	double period_hi = range * 1.2;
+	double a_lo = min_period, a_hi = period_hi;
+	double b_lo = min_period, b_hi = period_hi;
+
+	latency_model best { h.lo, min_period, min_period, -std::numeric_limits<double>::infinity() };
+
+	for (int round = 0; round < 8; ++round) {
+		std::vector<latency_model> results(threads, best);
+		std::vector<std::thread> workers;
+
+		for (unsigned int t = 0; t < threads; ++t) {
+			workers.emplace_back([&, t]() {
+				for (int i = t; i <= grid; i += threads) {
+					const double offset = offset_lo + (offset_hi - offset_lo) * i / grid;
+					for (int j = 0; j <= grid; ++j) {
+						const double a = a_lo + (a_hi - a_lo) * j / grid;
+						for (int k = 0; k <= grid; ++k) {
+							const double b = b_lo + (b_hi - b_lo) * k / grid;
+							if (b < a) {
+								continue;
+							}
+
+							const double ll = model_loglik(h, offset, a, b);
+							if (ll > results[t].loglik) {
+								results[t] = { offset, a, b, ll };
+							}
+						}
+					}
+				}
+			});
+		}
+
+		for (auto& w : workers) {
+			w.join();
+		}
+
+		for (const auto& r : results) {
+			if (r.loglik > best.loglik) {
+				best = r;
+			}
+		}
+
+		const auto zoom = [](double& lo, double& hi, const double center, const double min) {
+			const double half = (hi - lo) / grid * 2;
+			lo = std::max(min, center - half);
+			hi = center + half;
+		};
+
+		zoom(offset_lo, offset_hi, best.offset, -std::numeric_limits<double>::infinity());
+		zoom(a_lo, a_hi, best.short_period, min_period);
+		zoom(b_lo, b_hi, best.long_period, min_period);
+	}
+
+	return best;
+}
+
+void print_fit(const std::string& path) {
+	std::vector<std::chrono::nanoseconds> times;
+	try {
+		const auto trials = load_archive(path);
+		times.assign(std::begin(trials.time), std::end(trials.time));
+	} catch (const std::runtime_error& e) {
+		std::cerr << "Could not load " << path << ": " << e.what() << std::endl;
+		exit(1);
+	}
+
+	if (times.size() < 10) {
+		std::cerr << "Need at least 10 samples to fit, got " << times.size() << std::endl;
+		exit(1);
+	}
+
+	const auto s = summarize(times);
+	const double lo = s.min.count();
+	const double hi = std::max(lo + 1, static_cast<double>(s.max.count()) + 1);
+	const std::size_t bins = 256;
+
+	const auto threads = std::max(1u, std::thread::hardware_concurrency());
+	const auto best = fit_model(make_histogram(times, lo, hi, bins), threads);
+
+	// Bootstrap for the uncertainty; replicates are spread across threads
+	// and each is fitted single-threaded.
+	const int replicates = 100;
+	std::vector<latency_model> boot(replicates);
+	std::vector<std::thread> workers;
+
+	for (unsigned int t = 0; t < threads; ++t) {
+		workers.emplace_back([&, t]() {
+			std::mt19937 rand_gen(30380 + t);
+			std::uniform_int_distribution<std::size_t> index_dist(0, times.size() - 1);
+			std::vector<std::chrono::nanoseconds> resampled(times.size());
+
+			for (int r = t; r < replicates; r += threads) {
+				for (auto& v : resampled) {
+					v = times[index_dist(rand_gen)];
+				}
+				boot[r] = fit_model(make_histogram(resampled, lo, hi, bins), 1);
+			}
+		});
+	}
+
+	for (auto& w : workers) {
+		w.join();
+	}
+
+	const auto interval = [&](const auto field) {
+		std::vector<double> vals;
+		for (const auto& b : boot) {
+			vals.push_back(b.*field);
+		}
+		std::sort(std::begin(vals), std::end(vals));
+
+		std::stringstream ss;
+		ss << "[" << static_cast<long long>(vals[replicates * 25 / 1000]) << ","
+		   << static_cast<long long>(vals[replicates * 975 / 1000]) << "]";
+		return ss.str();
+	};
+
+	// Which uniform is the matrix scan and which the usb poll can't be told
+	// apart from latencies alone; compare against the endpoint's bInterval.
+	std::cout << "{\"fit\":{\"samples\":" << times.size() << ","
+	          << "\"offset\":" << static_cast<long long>(best.offset) << ","
+	          << "\"offset_ci\":" << interval(&latency_model::offset) << ","
+	          << "\"short_period\":" << static_cast<long long>(best.short_period) << ","
+	          << "\"short_period_ci\":" << interval(&latency_model::short_period) << ","
+	          << "\"long_period\":" << static_cast<long long>(best.long_period) << ","
+	          << "\"long_period_ci\":" << interval(&latency_model::long_period) << ","
+	          << "\"loglik\":" << best.loglik << "}}" << std::endl;
+}
+
+void print_pack(const std::string& path) {
+	try {
+		archive_meta meta;
+		const auto trials = load_archive(path, &meta);
+		const auto packed = pack_records(trials, meta);
+		std::cout.write(packed.data(), packed.size());
+	} catch (const std::runtime_error& e) {
+		std::cerr << "Could not pack " << path << ": " << e.what() << std::endl;
+		exit(1);
+	}
+}
+
+void print_codec_bench(const std::string& path) {
+	trial_records trials;
+	try {
+		trials = load_archive(path);
+	} catch (const std::runtime_error& e) {
+		std::cerr << "Could not load " << path << ": " << e.what() << std::endl;
+		exit(1);
+	}
+
+	const char* names[] = { "key", "flags", "time", "released", "planned", "slept", "press", "release", "kernel", "polls" };
+	const int reps = 20;
+	std::size_t c = 0;
+	std::size_t total_raw = 0;
+	std::size_t total_encoded = 0;
+
+	trials.each_column([&](const auto& column) {
+		using T = std::remove_reference_t<decltype(column[0])>;
+
+		std::string encoded;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int r = 0; r < reps; ++r) {
+			encoded.clear();
+			encode_column(column, encoded);
+		}
+		const std::chrono::duration<double> encode_time = std::chrono::high_resolution_clock::now() - start;
+
+		std::vector<T> out(column.size());
+		const Column<T> out_column(out.data(), out.size());
+		const auto* data = reinterpret_cast<const unsigned char*>(encoded.data());
+		start = std::chrono::high_resolution_clock::now();
+		for (int r = 0; r < reps; ++r) {
+			decode_column(data, data + encoded.size(), out_column);
+		}
+		const std::chrono::duration<double> decode_time = std::chrono::high_resolution_clock::now() - start;
+
+		if (!std::equal(column.begin(), column.end(), out.begin())) {
+			std::cerr << "Round trip failed for column " << names[c] << std::endl;
+			exit(1);
+		}
+
+		const std::size_t raw = column.size() * sizeof(T);
+		const double mb = static_cast<double>(raw) * reps / 1e6;
+
+		std::cout << "{\"column\":\"" << names[c] << "\","
+		          << "\"raw\":" << raw << ","
+		          << "\"encoded\":" << encoded.size() << ","
+		          << "\"ratio\":" << (encoded.empty() ? 0 : static_cast<double>(raw) / encoded.size()) << ","
+		          << "\"encode_mbps\":" << mb / encode_time.count() << ","
+		          << "\"decode_mbps\":" << mb / decode_time.count() << "}" << std::endl;
+
+		total_raw += raw;
+		total_encoded += encoded.size();
+		++c;
+	});
+
+	// What measure() would have printed for the latencies alone.
+	std::size_t text = 0;
+	for (const auto& t : trials.time) {
+		text += std::to_string(t.count()).size() + 1;
+	}
+
+	std::cout << "{\"trials\":" << trials.size() << ","
+	          << "\"raw\":" << total_raw << ","
+	          << "\"encoded\":" << total_encoded << ","
+	          << "\"time_text\":" << text << "}" << std::endl;
+}
+
+void print_histogram(const trial_records& trials) {
+	const std::size_t bins = 50;
+
+	// min..p99 in equal bins, with everything above p99 in the last one.
+	const auto s = summarize(std::vector<std::chrono::nanoseconds>(std::begin(trials.time), std::end(trials.time)));
+	const auto width = std::max<long long>(1, (s.p99 - s.min).count() / (bins - 1));
+
+	std::vector<std::size_t> counts(bins);
+	for (const auto& t : trials.time) {
+		++counts[std::min(bins - 1, static_cast<std::size_t>((t - s.min).count() / width))];
+	}
+
+	std::cout << "{\"histogram\":{\"lo\":" << s.min.count() << ",\"width\":" << width << ",\"counts\":[";
+	for (std::size_t b = 0; b < bins; ++b) {
+		std::cout << (b ? "," : "") << counts[b];
+	}
+	std::cout << "]}}" << std::endl;
+}
+
+// Probability that a sample from `b` is slower than one from `a`, ties
+// counting half (the Mann-Whitney U statistic, normalized).
+double superiority(std::vector<std::chrono::nanoseconds> a, std::vector<std::chrono::nanoseconds> b) {
+	if (a.empty() || b.empty()) {
+		return 0.5;
+	}
+
+	std::sort(std::begin(a), std::end(a));
+	std::sort(std::begin(b), std::end(b));
+
+	double wins = 0;
+	for (const auto& t : b) {
+		const auto lo = std::lower_bound(std::begin(a), std::end(a), t);
+		const auto hi = std::upper_bound(lo, std::end(a), t);
+		wins += (lo - std::begin(a)) + (hi - lo) / 2.0;
+	}
+
+	return wins / (static_cast<double>(a.size()) * b.size());
+}
+
+void print_analysis() {
+	std::optional<std::pair<std::string, std::vector<std::chrono::nanoseconds>>> baseline;
+
+	for (const auto& path : config.analyze) {
+		trial_records trials;
+		archive_meta meta;
+
+		try {
+			trials = load_archive(path, &meta);
+		} catch (const std::runtime_error& e) {
+			std::cerr << "Could not load " << path << ": " << e.what() << std::endl;
+			exit(1);
+		}
+
+		// Each archive brings its own key codes and their devices.
+		config.keys.clear();
+		for (std::size_t k = 0; k < meta.codes.size(); ++k) {
+			config.keys.push_back({ g_pin_output, meta.codes[k], {}, {}, k < meta.devices.size() ? meta.devices[k] : 0 });
+		}
+
+		std::cout << "{\"file\":" << json_string(path) << ","
+		          << "\"format\":\"" << archive_format(path) << "\","
+		          << "\"config\":" << (meta.config.empty() ? "null" : meta.config) << "}" << std::endl;
+
+		print_summary(trials);
+		print_histogram(trials);
+
+		const auto warmup = find_warmup(std::vector<std::chrono::nanoseconds>(std::begin(trials.time), std::end(trials.time)));
+		std::vector<std::chrono::nanoseconds> times(std::begin(trials.time) + warmup, std::end(trials.time));
+
+		if (!baseline) {
+			baseline.emplace(path, std::move(times));
+			continue;
+		}
+
+		const auto a = summarize(baseline->second);
+		const auto b = summarize(times);
+
+		std::cout << "{\"compare\":{\"baseline\":" << json_string(baseline->first) << ","
+		          << "\"candidate\":" << json_string(path) << ","
+		          << "\"median_diff\":" << (b.median - a.median).count() << ","
+		          << "\"p99_diff\":" << (b.p99 - a.p99).count() << ","
+		          << "\"mean_diff\":" << static_cast<long long>(b.mean - a.mean) << ","
+		          << "\"p_slower\":" << superiority(baseline->second, times) << "}}" << std::endl;
+	}
+}
+
+// Fails (exit 2) when the candidate's median or p99 is worse than the
+// baseline's by more than the threshold. Each side gets a one-sided bound at
+// sqrt(confidence), so together they hold at the requested level: the gate
+// only trips when even the candidate's lower bound is past the baseline's
+// upper bound plus the threshold.
+void print_gate(const std::string& baseline_path, const std::string& candidate_path) {
+	std::vector<std::chrono::nanoseconds> baseline, candidate;
+
+	for (auto [path, times] : { std::pair { &baseline_path, &baseline }, std::pair { &candidate_path, &candidate } }) {
+		try {
+			*times = load_archive_times(*path);
+		} catch (const std::runtime_error& e) {
+			std::cerr << "Could not load " << *path << ": " << e.what() << std::endl;
+			exit(1);
+		}
+
+		times->erase(std::begin(*times), std::begin(*times) + find_warmup(*times));
+		if (times->empty()) {
+			std::cerr << "No samples in " << *path << std::endl;
+			exit(1);
+		}
+	}
+
+	const double side = std::sqrt(config.gate_confidence);
+	const double allowed = 1 + config.gate_threshold / 100;
+	bool pass = true;
+
+	std::cout << "{\"gate\":{\"baseline\":" << json_string(baseline_path) << ","
+	          << "\"candidate\":" << json_string(candidate_path) << ","
+	          << "\"threshold\":" << config.gate_threshold << ","
+	          << "\"confidence\":" << config.gate_confidence;
+
+	for (const auto& [name, q] : { std::pair { "median", 0.5 }, std::pair { "p99", 0.99 } }) {
+		const auto a = quantile_interval(baseline, q, side);
+		const auto b = quantile_interval(candidate, q, side);
+		const bool regressed = b.lower.count() > a.upper.count() * allowed;
+		pass = pass && !regressed;
+
+		std::cout << ",\"" << name << "\":{\"baseline\":" << a.estimate.count() << ","
+		          << "\"candidate\":" << b.estimate.count() << ","
+		          << "\"change\":" << std::fixed << std::setprecision(2)
+		          << 100.0 * (b.estimate - a.estimate).count() / std::max<long long>(1, a.estimate.count())
+		          << std::defaultfloat << std::setprecision(6) << ","
+		          << "\"baseline_upper\":" << a.upper.count() << ","
+		          << "\"candidate_lower\":" << b.lower.count() << ","
+		          << "\"regressed\":" << (regressed ? "true" : "false") << "}";
+	}
+
+	std::cout << ",\"pass\":" << (pass ? "true" : "false") << "}}" << std::endl;
+
+	if (!pass) {
+		exit(2);
+	}
+}
+
+// Follows a feed from its oldest record, printing --records lines, until the
+// run ends. A reader that's lapped by the writer skips ahead to the newer
+// half of the ring and says how many records it lost.
+void print_feed(const std::string& name) {
+	const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0 || static_cast<std::size_t>(st.st_size) < sizeof(feed_header)) {
+		std::cerr << "Could not open feed " << name << std::endl;
+		exit(1);
+	}
+
+	void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED) {
+		std::cerr << "Could not map feed " << name << std::endl;
+		exit(1);
+	}
+
+	const auto& header = *static_cast<const feed_header*>(data);
+	const auto capacity = header.capacity;
+
+	if (std::memcmp(header.magic, g_feed_magic, sizeof(header.magic)) != 0 || header.version != 2 ||
+			sizeof(feed_header) + sizeof(feed_record) * capacity > static_cast<std::size_t>(st.st_size)) {
+		std::cerr << name << " is not a feed" << std::endl;
+		exit(1);
+	}
+
+	const auto* records = reinterpret_cast<const feed_record*>(static_cast<const char*>(data) + sizeof(feed_header));
+	const auto start = header.head.load(std::memory_order_acquire);
+	std::uint64_t next = start > capacity ? start - capacity : 0;
+	std::int64_t values[g_feed_values];
+
+	const auto resync = [&]() {
+		const auto now = header.head.load(std::memory_order_acquire);
+		const auto ahead = now - capacity / 2;
+		std::cerr << "Fell behind the feed, skipped " << ahead - next << " records" << std::endl;
+		next = ahead;
+	};
+
+	for (;;) {
+		const auto head = header.head.load(std::memory_order_acquire);
+
+		if (next == head) {
+			std::cout << std::flush;
+			if (header.done.load(std::memory_order_acquire) && header.head.load(std::memory_order_acquire) == next) {
+				break;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+
+		if (head - next > capacity) {
+			resync();
+			continue;
+		}
+
+		const auto& r = records[next % capacity];
+		const auto seq = r.seq.load(std::memory_order_acquire);
+
+		for (std::size_t v = 0; v < g_feed_values; ++v) {
+			values[v] = r.values[v].load(std::memory_order_relaxed);
+		}
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (seq != 2 * next + 2 || r.seq.load(std::memory_order_relaxed) != seq) {
+			resync();
+			continue;
+		}
+
+		// Like print_trial, only --ab lines start with the device.
+		for (std::size_t v = header.ab ? 0 : 1; v < g_feed_values; ++v) {
+			std::cout << values[v] << (v == g_feed_values - 1 ? '\n' : ' ');
+		}
+		++next;
+	}
+
+	munmap(data, st.st_size);
+}
+
+// Chrome trace-event JSON of every trial, for chrome://tracing or Perfetto.
+// Each key gets a track with the sleep, the press from stimulus to
+// detection and the release as spans, the kernel event as an instant, and
+// counters for latency and polls.
+void print_trace(const std::string& path) {
+	trial_records trials;
+	archive_meta meta;
+
+	try {
+		trials = load_archive(path, &meta);
+	} catch (const std::runtime_error& e) {
+		std::cerr << "Could not load " << path << ": " << e.what() << std::endl;
+		exit(1);
+	}
+
+	if (trials.size() == 0 || std::all_of(std::begin(trials.press), std::end(trials.press), [](const auto t) { return t.count() == 0; })) {
+		std::cerr << "Tracing needs full trial records (--records output, a store or a pack)" << std::endl;
+		exit(1);
+	}
+
+	const auto t0 = trials.press[0] - trials.slept[0];
+	const auto us = [&](const std::chrono::nanoseconds t) {
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(3) << (t - t0).count() / 1000.0;
+		return ss.str();
+	};
+	const auto dur = [](const std::chrono::nanoseconds t) {
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(3) << t.count() / 1000.0;
+		return ss.str();
+	};
+
+	std::ostream& out = std::cout;
+	out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+	out << "{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":" << json_string(path) << "}}";
+
+	for (std::size_t k = 0; k < meta.codes.size(); ++k) {
+		out << ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":" << k << ",\"name\":\"thread_name\",\"args\":{\"name\":\"key " << meta.codes[k] << "\"}}";
+	}
+
+	for (std::size_t i = 0; i < trials.size(); ++i) {
+		const auto tid = trials.key[i];
+		const auto head = [&](const char* ph, const char* name, const std::chrono::nanoseconds ts) {
+			out << ",\n{\"ph\":\"" << ph << "\",\"pid\":1,\"tid\":" << tid << ",\"name\":\"" << name << "\",\"ts\":" << us(ts);
+		};
+
+		head("X", "sleep", trials.press[i] - trials.slept[i]);
+		out << ",\"dur\":" << dur(trials.slept[i]) << ",\"args\":{\"trial\":" << i << ",\"planned\":" << trials.planned[i].count() << "}}";
+
+		head("X", "press", trials.press[i]);
+		out << ",\"dur\":" << dur(trials.time[i]) << ",\"args\":{\"trial\":" << i << ",\"latency\":" << trials.time[i].count()
+		    << ",\"polls\":" << trials.polls[i] << "}}";
+
+		if (trials.flags[i] & trial_flags::kernel_time) {
+			head("i", "kernel event", trials.kernel[i]);
+			out << ",\"s\":\"t\",\"args\":{\"trial\":" << i << "}}";
+		}
+
+		head("X", "release", trials.release[i]);
+		out << ",\"dur\":" << dur(trials.released[i]) << ",\"args\":{\"trial\":" << i << "}}";
+
+		head("C", "latency", trials.press[i] + trials.time[i]);
+		out << ",\"args\":{\"ns\":" << trials.time[i].count() << "}}";
+
+		head("C", "polls", trials.press[i] + trials.time[i]);
+		out << ",\"args\":{\"polls\":" << trials.polls[i] << "}}";
+	}
+
+	out << "\n]}" << std::endl;
+}
+
+// Per-worker task deques. A worker takes from the back of its own deque and,
+// once that's empty, steals from the front of the others'.
+class WorkQueues {
+	public:
+
+	WorkQueues(const std::size_t workers, const std::size_t tasks) : _queues(workers) {
+		for (std::size_t i = 0; i < tasks; ++i) {
+			_queues[i % workers].tasks.push_back(i);
+		}
+	}
+
+	std::optional<std::size_t> next(const std::size_t worker) {
+		{
+			auto& own = _queues[worker];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (!own.tasks.empty()) {
+				const auto task = own.tasks.back();
+				own.tasks.pop_back();
+				return task;
+			}
+		}
+
+		for (std::size_t i = 1; i < _queues.size(); ++i) {
+			auto& victim = _queues[(worker + i) % _queues.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.tasks.empty()) {
+				const auto task = victim.tasks.front();
+				victim.tasks.pop_front();
+				return task;
+			}
+		}
+
+		return {};
+	}
+
+	private:
+	struct queue {
+		std::mutex mutex;
+		std::deque<std::size_t> tasks;
+	};
+
+	std::vector<queue> _queues;
+};
+
+struct batch_row {
+	std::string format;
+	std::size_t warmup = 0;
+	std::optional<summary> stats;
+	std::optional<latency_model> model;
+};
+
+// Summarizes every archive under `dir`, one row per run. Each worker holds
+// one archive at a time and keeps only its row, so memory is bounded by the
+// largest archive times the number of workers, not by the number of runs.
+void print_batch_analysis(const std::string& dir) {
+	std::vector<std::string> paths;
+	try {
+		for (const auto& entry : std::filesystem::recursive_directory_iterator(dir)) {
+			if (entry.is_regular_file()) {
+				paths.push_back(entry.path().string());
+			}
+		}
+	} catch (const std::filesystem::filesystem_error& e) {
+		std::cerr << "Could not list " << dir << ": " << e.what() << std::endl;
+		exit(1);
+	}
+	std::sort(std::begin(paths), std::end(paths));
+
+	const auto threads = std::max(1u, std::thread::hardware_concurrency());
+	WorkQueues queues(threads, paths.size());
+	std::vector<batch_row> rows(paths.size());
+	std::vector<std::thread> workers;
+
+	for (unsigned int t = 0; t < threads; ++t) {
+		workers.emplace_back([&, t]() {
+			while (const auto task = queues.next(t)) {
+				auto& row = rows[*task];
+				const auto& path = paths[*task];
+
+				// One bad file, however bad (bad_alloc from a corrupt count
+				// included), only costs its own row.
+				try {
+					row.format = archive_format(path);
+					auto times = load_archive_times(path, 1);
+
+					row.warmup = find_warmup(times);
+					times.erase(std::begin(times), std::begin(times) + row.warmup);
+					if (times.empty()) {
+						continue;
+					}
+
+					row.stats = summarize(times);
+					if (times.size() >= 10) {
+						const double lo = row.stats->min.count();
+						const double hi = std::max(lo + 1, static_cast<double>(row.stats->max.count()) + 1);
+						row.model = fit_model(make_histogram(times, lo, hi, 256), 1);
+					}
+				} catch (const std::exception& e) {
+					row.stats.reset();
+					row.model.reset();
+					std::cerr << "Skipping " << path << ": " << e.what() << std::endl;
+				}
+			}
+		});
+	}
+
+	for (auto& w : workers) {
+		w.join();
+	}
+
+	std::cout << "path\tformat\tcount\twarmup\tmin\tmedian\tp90\tp99\tmax\tmean\tshort_period\tlong_period" << std::endl;
+	for (std::size_t i = 0; i < paths.size(); ++i) {
+		const auto& row = rows[i];
+		if (!row.stats) {
+			continue;
+		}
+
+		const auto& s = *row.stats;
+		std::cout << paths[i] << "\t" << row.format << "\t" << s.count << "\t" << row.warmup << "\t"
+		          << s.min.count() << "\t" << s.median.count() << "\t" << s.p90.count() << "\t"
+		          << s.p99.count() << "\t" << s.max.count() << "\t" << static_cast<long long>(s.mean) << "\t";
+		if (row.model) {
+			std::cout << static_cast<long long>(row.model->short_period) << "\t"
+			          << static_cast<long long>(row.model->long_period) << std::endl;
+		} else {
+			std::cout << "-\t-" << std::endl;
+		}
+	}
+}
+
+void load_keymap(const std::string& path) {
+	std::ifstream file(path);
+
+	if (!file) {
+		std::cerr << "Could not open keymap " << path << std::endl;
+		exit(1);
+	}
+
+	std::string line;
+	int line_num = 0;
+	while (std::getline(file, line)) {
+		++line_num;
+
+		line = line.substr(0, line.find('#'));
+
+		std::istringstream ls(line);
+		key_binding key;
+		if (!(ls >> key.pin)) {
+			continue;
+		}
+
+		if (!(ls >> key.code)) {
+			std::cerr << "keymap line " << line_num << ": expected <pin> <key_code> [<row> <col>]" << std::endl;
+			exit(1);
+		}
+
+		int row;
+		int col;
+		if (ls >> row >> col) {
+			key.row = row;
+			key.col = col;
+		}
+
+		if (key.pin == g_pin_input || key.pin < 0 || (key.row && (*key.row < 0 || *key.col < 0))) {
+			std::cerr << "keymap line " << line_num << ": invalid pin or position" << std::endl;
+			exit(1);
+		}
+
+		config.keys.push_back(key);
+	}
+
+	if (config.keys.empty()) {
+		std::cerr << "keymap " << path << " has no keys" << std::endl;
+		exit(1);
+	}
+}
+
+void parse_sequence(const std::string& text) {
+	std::string spaced = text;
+	std::replace(std::begin(spaced), std::end(spaced), ',', ' ');
+
+	std::istringstream ts(spaced);
+	std::string token;
+	while (ts >> token) {
+		std::vector<std::string> args;
+		std::istringstream as(token);
+		for (std::string arg; std::getline(as, arg, ':');) {
+			args.push_back(arg);
+		}
+
+		const auto fail = [&]() {
+			std::cerr << "Invalid sequence step '" << token << "'" << std::endl;
+			exit(1);
+		};
+
+		const auto parse_num = [&](const std::string& arg) {
+			int val = -1;
+			try {
+				val = std::stoi(arg);
+			} catch (const std::exception&) {
+			}
+
+			if (val < 0) {
+				fail();
+			}
+
+			return val;
+		};
+
+		const auto num = [&](const std::size_t i) {
+			return parse_num(args[i]);
+		};
+
+		const auto keys = [&](const std::size_t i) {
+			std::vector<std::size_t> ret;
+			std::istringstream ks(args[i]);
+			for (std::string k; std::getline(ks, k, '+');) {
+				const auto key = static_cast<std::size_t>(parse_num(k));
+				if (key >= config.keys.size()) {
+					fail();
+				}
+				ret.push_back(key);
+			}
+
+			if (ret.empty()) {
+				fail();
+			}
+
+			return ret;
+		};
+
+		const auto write = [&](const std::vector<std::size_t>& k, const bool pressed) {
+			config.steps.push_back({ sequence_step::kind::write, k, pressed });
+		};
+
+		const auto wait = [&](const int us) {
+			config.steps.push_back({ sequence_step::kind::wait, {}, false, std::chrono::microseconds(us) });
+		};
+
+		const auto& name = args[0];
+		if ((name == "down" || name == "up") && args.size() == 2) {
+			write(keys(1), name == "down");
+		} else if (name == "wait" && args.size() == 2) {
+			wait(num(1));
+		} else if (name == "sync" && args.size() == 1) {
+			config.steps.push_back({ sequence_step::kind::sync });
+		} else if (name == "tap" && args.size() == 3) {
+			const auto k = keys(1);
+			write(k, true);
+			wait(num(2));
+			write(k, false);
+		} else if (name == "double" && args.size() == 4) {
+			const auto k = keys(1);
+			for (int tap = 0; tap < 2; ++tap) {
+				if (tap) {
+					wait(num(3));
+				}
+				write(k, true);
+				wait(num(2));
+				write(k, false);
+			}
+		} else if (name == "toggle" && args.size() == 4) {
+			const auto k = keys(1);
+			for (int n = num(2); n > 0; --n) {
+				write(k, true);
+				wait(num(3) / 2);
+				write(k, false);
+				wait(num(3) / 2);
+			}
+		} else {
+			fail();
+		}
+	}
+
+	// Always give the last edges a chance to show up before the next trial.
+	config.steps.push_back({ sequence_step::kind::sync });
+}
+
+void help(const bool err) {
+	program_config defaults;
+
+	std::stringstream help_msg;
+	help_msg << "-i, --iterations <n>   Number of iterations to perform (default: " << defaults.iterations << ")." << std::endl
+	         << "-d, --delaymin <n>     Minimum delay between measurements (default: " << defaults.delay_min << ")." << std::endl
+	         << "-D, --delaymax <n>     Maximum delay between measurements (default: " << defaults.delay_max << ")." << std::endl
+	         << "-p, --pin              Run pin-based measurement." << std::endl
+	         << "-u, --usb <event_id>   Run usb-based measurement. Pass an evdev event id." << std::endl
+	         << "-U, --uinput           Run loopback measurement: keys are pressed through a virtual" << std::endl
+	         << "                       uinput keyboard and detected on its evdev node. Needs no" << std::endl
+	         << "                       hardware; takes --key or --keymap like usb." << std::endl
+	         << "-k, --key <event_code> Event code of the key used for measurement." << std::endl
+	         << "                       See kernel 'input-event-codes.h'." << std::endl
+	         << "-m, --keymap <file>    Measure several keys in random order (usb or uinput)." << std::endl
+	         << "                       One '<pin> <key_code> [<row> <col>]' per line." << std::endl
+	         << "-S, --sequence <steps> Run a scripted sequence per trial instead of a single press." << std::endl
+	         << "                       Steps: down:K up:K wait:US sync tap:K:HOLD" << std::endl
+	         << "                       double:K:HOLD:GAP toggle:K:COUNT:PERIOD" << std::endl
+	         << "                       K is a keymap index, or a chord like 0+1." << std::endl
+	         << "-t, --timeout <n>      Microseconds to wait for a detection in sequence, pulse and" << std::endl
+	         << "                       idle modes (default: " << defaults.timeout << ")." << std::endl
+	         << "-w, --pulse <min:max[:res]>" << std::endl
+	         << "                       Binary search the shortest pulse (ns) detected in at least half" << std::endl
+	         << "                       of <iterations> repetitions. Prints width, actual width," << std::endl
+	         << "                       detections and repetitions per tested width." << std::endl
+	         << "-I, --idle <min:max[:steps]>" << std::endl
+	         << "                       Sweep idle time (ms, log spaced) before each press, with" << std::endl
+	         << "                       <iterations> presses per step. Prints idle time and latency." << std::endl
+	         << "-x, --ab <event_id>:<pin>[:<key_code>]" << std::endl
+	         << "                       Interleave trials on a second device in balanced random" << std::endl
+	         << "                       blocks (usb only), driven from <pin>, and compare the two" << std::endl
+	         << "                       in pairs in the summary. The key code defaults to --key." << std::endl
+	         << "                       Trial lines start with the device (0 or 1) and key code," << std::endl
+	         << "                       and each device is summarized and cataloged on its own." << std::endl
+	         << "-a, --autosuspend <on|off>" << std::endl
+	         << "                       Force usb autosuspend during the run (usb only)." << std::endl
+	         << "-W, --warmup <n|auto[:n]>" << std::endl
+	         << "                       Leave warm-up trials out of the summary: a fixed count, or" << std::endl
+	         << "                       detected from the running median with a fixed fallback." << std::endl
+	         << "-c, --drift <n>[:<arl>]" << std::endl
+	         << "                       Report latency shifts (CUSUM against a reference learned" << std::endl
+	         << "                       from <n> trials) and a time x latency heatmap in the summary." << std::endl
+	         << "                       A stationary run gives a false alarm about once every <arl>" << std::endl
+	         << "                       trials (default: " << defaults.drift_arl << ")." << std::endl
+	         << "-r, --records          Print key code, planned delay, actual delay, press time," << std::endl
+	         << "                       release time, kernel event time, release latency, polls and" << std::endl
+	         << "                       flags before each latency." << std::endl
+	         << "-P, --phase <min:max:step>" << std::endl
+	         << "                       Fold press times over candidate periods (us) and report how" << std::endl
+	         << "                       strongly latency depends on phase, in the summary." << std::endl
+	         << "-H, --hugepages        Back the trial records with huge pages." << std::endl
+	         << "-o, --store <file>     Write trial records to a memory-mapped store instead of" << std::endl
+	         << "                       printing them. Memory use doesn't grow with iterations." << std::endl
+	         << "                       The summary is then read back in chunks, with quantiles" << std::endl
+	         << "                       binned to about 1% and only the fixed --warmup count." << std::endl
+	         << "-F, --fit <file>       Fit offset + uniform scan + uniform poll delays to saved" << std::endl
+	         << "                       measurements ('-' for stdin), with bootstrap intervals." << std::endl
+	         << "-z, --pack <store>     Write a store as a compressed archive to stdout." << std::endl
+	         << "-B, --bench-codec <archive>" << std::endl
+	         << "                       Benchmark archive compression on a store or pack." << std::endl
+	         << "-A, --analyze <archive>" << std::endl
+	         << "                       Summarize a saved run (text output, store or pack). Repeat to" << std::endl
+	         << "                       compare later runs against the first. Honours --warmup," << std::endl
+	         << "                       --drift and --phase." << std::endl
+	         << "-b, --batch-analyze <dir>" << std::endl
+	         << "                       Summarize every saved run under a directory as a table of" << std::endl
+	         << "                       latency stats and fitted poll periods. Honours --warmup." << std::endl
+	         << "-g, --baseline <archive>" << std::endl
+	         << "-G, --candidate <archive>" << std::endl
+	         << "                       Regression gate: exit with 2 if the candidate's median or" << std::endl
+	         << "                       p99 is worse than the baseline's. Honours --warmup." << std::endl
+	         << "-T, --threshold <percent>" << std::endl
+	         << "                       Regression the gate tolerates (default: 5)." << std::endl
+	         << "-L, --confidence <percent>" << std::endl
+	         << "                       Confidence the gate needs before failing (default: 95)." << std::endl
+	         << "-C, --catalog <dir>    Run catalog every measurement is added to, or 'none'" << std::endl
+	         << "                       (default: $XDG_DATA_HOME/measure-input-latency)." << std::endl
+	         << "-Q, --query <filter>   List cataloged runs and p99 by firmware. Filter terms:" << std::endl
+	         << "                       vendor=<hex>,product=<hex>,firmware=<s>,name=<substring>" << std::endl
+	         << "-M, --metrics <port>   Serve live latency histogram, quantiles and missed and late" << std::endl
+	         << "                       wakeup counts on localhost:<port> in OpenMetrics format." << std::endl
+	         << "-X, --trace <archive>  Write trials as Chrome trace-event JSON, for chrome://tracing" << std::endl
+	         << "                       or ui.perfetto.dev. Needs full records, not just latencies." << std::endl
+	         << "-y, --cpu <n>          Pin the trial loop to a CPU." << std::endl
+	         << "-Y, --priority <n>     Run the trial loop with SCHED_FIFO priority <n>." << std::endl
+	         << "-j, --jitter <n>       Measure <n> 1ms timer wakeups on the trial loop's CPU and" << std::endl
+	         << "                       priority before the run, and sample more at 10Hz during it." << std::endl
+	         << "                       Recorded in the config, summary and catalog." << std::endl
+	         << "-J, --max-jitter <us>  Refuse to run (exit 1), or fail the run (exit 2), when the" << std::endl
+	         << "                       wakeup p99 before or during it is above <us>." << std::endl
+	         << "-E, --load <kind>[:<threads>[:<percent>]][@<cpus>]" << std::endl
+	         << "                       Run background load while measuring, for <percent> of every" << std::endl
+	         << "                       10ms (default: 1 thread, 100%), pinned to cpus like 2 or" << std::endl
+	         << "                       1-3. Kinds: cpu, mem, cache, disk, irq. Repeatable; recorded" << std::endl
+	         << "                       in the config, with achieved rates in the summary." << std::endl
+	         << "-K, --tracefs          Trace irq, softirq and scheduler events through tracefs (root)" << std::endl
+	         << "                       and attribute host-side latency in the summary." << std::endl
+	         << "-O, --flight <us>[:<dir>]" << std::endl
+	         << "                       Dump the recent raw events (evdev reads, pin edges, sleeps," << std::endl
+	         << "                       writes) to <dir>/flight-<n>.txt when a trial takes longer" << std::endl
+	         << "                       than <us> or a detection or --sequence sync times out. At" << std::endl
+	         << "                       most 100 dumps." << std::endl
+	         << "-f, --feed <name>      Publish trial records to a shared-memory ring (/dev/shm/<name>)" << std::endl
+	         << "                       that local readers can tail while measuring." << std::endl
+	         << "-l, --tail <name>      Print a feed's records as --records lines until its run ends." << std::endl
+	         << "-n, --daemon <socket>  Keep GPIO set up and run requests from a UNIX socket, one at" << std::endl
+	         << "                       a time. A request is a line of options, split at whitespace" << std::endl
+	         << "                       with shell-style '', \"\" and \\ quoting; the run's output is" << std::endl
+	         << "                       streamed back, a line per trial as it is measured, between" << std::endl
+	         << "                       {\"queued\":n} and {\"exit\":status}. An existing <socket> is" << std::endl
+	         << "                       only replaced if no daemon is listening on it." << std::endl
+	         << "                       A 'status' line reports the running and queued requests." << std::endl
+	         << "-e, --events           List names of evdev events." << std::endl
+	         << "-s, --summary          Print summary of measurements." << std::endl
+	         << "-h, --help             Show help." << std::endl;
+
+	if (err) {
+		std::cerr << help_msg.str();
+		exit(1);
+	} else {
+		std::cout << help_msg.str();
+		exit(0);
+	}
+}
+
+void parse_args(int argc, char** argv) {
+	const char* const optstring = "i:d:D:pUu:k:m:x:S:t:w:I:a:W:c:rP:Ho:F:z:B:A:b:g:G:T:L:C:Q:n:M:f:l:O:X:Ky:Y:j:J:E:esh";
+	const option longopts[] = {
+		{"iterations", required_argument, nullptr, 'i'},
+		{"delaymin", required_argument, nullptr, 'd'},
+		{"delaymax", required_argument, nullptr, 'D'},
+		{"pin", no_argument, nullptr, 'p'},
+		{"uinput", no_argument, nullptr, 'U'},
+		{"usb", required_argument, nullptr, 'u'},
 		{"key", required_argument, nullptr, 'k'},
+		{"keymap", required_argument, nullptr, 'm'},
+		{"ab", required_argument, nullptr, 'x'},
+		{"sequence", required_argument, nullptr, 'S'},
+		{"timeout", required_argument, nullptr, 't'},
+		{"pulse", required_argument, nullptr, 'w'},
+		{"idle", required_argument, nullptr, 'I'},
+		{"autosuspend", required_argument, nullptr, 'a'},
+		{"warmup", required_argument, nullptr, 'W'},
+		{"drift", required_argument, nullptr, 'c'},
+		{"records", no_argument, nullptr, 'r'},
+		{"phase", required_argument, nullptr, 'P'},
+		{"hugepages", no_argument, nullptr, 'H'},
+		{"store", required_argument, nullptr, 'o'},
 		{"events", no_argument, nullptr, 'e'},
+		{"fit", required_argument, nullptr, 'F'},
+		{"pack", required_argument, nullptr, 'z'},
+		{"bench-codec", required_argument, nullptr, 'B'},
+		{"analyze", required_argument, nullptr, 'A'},
+		{"batch-analyze", required_argument, nullptr, 'b'},
+		{"baseline", required_argument, nullptr, 'g'},
+		{"candidate", required_argument, nullptr, 'G'},
+		{"threshold", required_argument, nullptr, 'T'},
+		{"confidence", required_argument, nullptr, 'L'},
+		{"catalog", required_argument, nullptr, 'C'},
+		{"query", required_argument, nullptr, 'Q'},
+		{"daemon", required_argument, nullptr, 'n'},
+		{"metrics", required_argument, nullptr, 'M'},
+		{"feed", required_argument, nullptr, 'f'},
+		{"flight", required_argument, nullptr, 'O'},
+		{"trace", required_argument, nullptr, 'X'},
+		{"tracefs", no_argument, nullptr, 'K'},
+		{"cpu", required_argument, nullptr, 'y'},
+		{"priority", required_argument, nullptr, 'Y'},
+		{"jitter", required_argument, nullptr, 'j'},
+		{"max-jitter", required_argument, nullptr, 'J'},
+		{"load", required_argument, nullptr, 'E'},
+		{"tail", required_argument, nullptr, 'l'},
 		{"help", no_argument, nullptr, 'h'},
 		{"summary", no_argument, nullptr, 's'},
 		{nullptr, no_argument, nullptr, 0},
 	};
 
-	const auto get_num = [](const std::string name, const char* opt) {
-		int val;
-		try {
-			val = std::stoi(opt);
-		} catch (const std::invalid_argument&) {
-			std::cerr << name << " must be a number." << std::endl;
-			help(true);
-		}
+	const auto get_num = [](const std::string name, const char* opt) {
+		int val;
+		try {
+			val = std::stoi(opt);
+		} catch (const std::invalid_argument&) {
+			std::cerr << name << " must be a number." << std::endl;
+			help(true);
+		}
+
+		return val;
+	};
+
+	const auto get_positive = [&](const std::string name, const char* opt, const bool allow_zero = false) {
+		const auto val = get_num(name, opt);
+
+		if (val < 0 || (!allow_zero && 0 == val)) {
+			std::cerr << name << " must be greater than zero." << std::endl;
+			help(true);
+		}
+
+		return val;
+	};
+
+	while (true) {
+		const auto opt = getopt_long(argc, argv, optstring, longopts, nullptr);
+
+		if (-1 == opt) {
+			break;
+		}
+
+		switch (opt) {
+			case 'i':
+				config.iterations = get_positive("iterations", optarg);
+				break;
+
+			case 'd':
+				config.delay_min = get_positive("delaymin", optarg, true);
+				break;
+
+			case 'D':
+				config.delay_max = get_positive("delaymax", optarg, true);
+				break;
+
+			case 'p':
+				config.pin = true;
+				break;
+
+			case 'U':
+				config.uinput = true;
+				break;
+
+			case 'u':
+				config.usb = get_num("usb", optarg);
+				break;
+
+			case 'k':
+				config.key = get_num("key", optarg);
+				break;
+
+			case 'm':
+				config.keymap = optarg;
+				break;
+
+			case 'S':
+				config.sequence = optarg;
+				break;
+
+			case 't':
+				config.timeout = get_positive("timeout", optarg);
+				break;
+
+			case 'w': {
+				config.pulse = optarg;
+
+				std::vector<int> vals;
+				std::istringstream ps(optarg);
+				for (std::string val; std::getline(ps, val, ':');) {
+					vals.push_back(get_positive("pulse", val.c_str()));
+				}
+
+				if (vals.size() < 2 || vals.size() > 3 || vals[1] < vals[0]) {
+					std::cerr << "pulse must be <min>:<max>[:<resolution>] with min <= max" << std::endl;
+					help(true);
+				}
+
+				config.pulse_min = std::chrono::nanoseconds(vals[0]);
+				config.pulse_max = std::chrono::nanoseconds(vals[1]);
+				if (vals.size() == 3) {
+					config.pulse_resolution = std::chrono::nanoseconds(vals[2]);
+				}
+				break;
+			}
+
+			case 'I': {
+				config.idle = optarg;
+
+				std::vector<int> vals;
+				std::istringstream is(optarg);
+				for (std::string val; std::getline(is, val, ':');) {
+					vals.push_back(get_positive("idle", val.c_str()));
+				}
+
+				if (vals.size() < 2 || vals.size() > 3 || vals[1] < vals[0]) {
+					std::cerr << "idle must be <min>:<max>[:<steps>] with min <= max" << std::endl;
+					help(true);
+				}
+
+				const int steps = vals.size() == 3 ? vals[2] : 10;
+				const double ratio = steps > 1 ? std::pow(static_cast<double>(vals[1]) / vals[0], 1.0 / (steps - 1)) : 1.0;
+
+				for (int i = 0; i < steps; ++i) {
+					config.idle_steps.push_back(std::chrono::milliseconds(std::lround(vals[0] * std::pow(ratio, i))));
+				}
+				break;
+			}
+
+			case 'a':
+				if (std::string(optarg) != "on" && std::string(optarg) != "off") {
+					std::cerr << "autosuspend must be on or off" << std::endl;
+					help(true);
+				}
+				config.autosuspend = std::string(optarg) == "on";
+				break;
+
+			case 'W': {
+				config.warmup = optarg;
 
-		return val;
-	};
+				std::string val(optarg);
+				if (val.rfind("auto", 0) == 0) {
+					config.warmup_auto = true;
+					val = val.size() > 5 && val[4] == ':' ? val.substr(5) : "0";
+				}
 
-	const auto get_positive = [&](const std::string name, const char* opt, const bool allow_zero = false) {
-		const auto val = get_num(name, opt);
+				config.warmup_count = get_positive("warmup", val.c_str(), true);
+				break;
+			}
 
-		if (val < 0 || (!allow_zero && 0 == val)) {
-			std::cerr << name << " must be greater than zero." << std::endl;
-			help(true);
-		}
+			case 'c': {
+				const std::string arg = optarg;
+				const auto colon = arg.find(':');
+				config.drift = get_positive("drift", arg.substr(0, colon).c_str());
+				if (colon != std::string::npos) {
+					config.drift_arl = get_positive("drift arl", arg.substr(colon + 1).c_str());
+				}
 
-		return val;
-	};
+				if (*config.drift < 2) {
+					std::cerr << "drift window must be at least 2" << std::endl;
+					help(true);
+				}
+				break;
+			}
 
-	while (true) {
-		const auto opt = getopt_long(argc, argv, optstring, longopts, nullptr);
+			case 'e':
+				config.events = true;
+				break;
 
-		if (-1 == opt) {
-			break;
-		}
+			case 'r':
+				config.records = true;
+				break;
 
-		switch (opt) {
-			case 'i':
-				config.iterations = get_positive("iterations", optarg);
+			case 'x':
+				config.ab = optarg;
 				break;
 
-			case 'd':
-				config.delay_min = get_positive("delaymin", optarg, true);
+			case 'P': {
+				config.phase = optarg;
+
+				std::vector<int> vals;
+				std::istringstream ps(optarg);
+				for (std::string val; std::getline(ps, val, ':');) {
+					vals.push_back(get_positive("phase", val.c_str()));
+				}
+
+				if (vals.size() != 3 || vals[1] < vals[0]) {
+					std::cerr << "phase must be <min>:<max>:<step> with min <= max" << std::endl;
+					help(true);
+				}
+
+				config.phase_min = std::chrono::microseconds(vals[0]);
+				config.phase_max = std::chrono::microseconds(vals[1]);
+				config.phase_step = std::chrono::microseconds(vals[2]);
 				break;
+			}
 
-			case 'D':
-				config.delay_max = get_positive("delaymax", optarg, true);
+			case 'H':
+				config.hugepages = true;
 				break;
 
-			case 'p':
-				config.pin = true;
+			case 'o':
+				config.store = optarg;
 				break;
 
-			case 'u':
-				config.usb = get_num("usb", optarg);
+			case 'F':
+				config.fit = optarg;
 				break;
 
-			case 'k':
-				config.key = get_num("key", optarg);
+			case 'z':
+				config.pack = optarg;
 				break;
 
-			case 'e':
-				config.events = true;
+			case 'B':
+				config.bench_codec = optarg;
+				break;
+
+			case 'A':
+				config.analyze.push_back(optarg);
+				break;
+
+			case 'b':
+				config.batch_analyze = optarg;
+				break;
+
+			case 'g':
+				config.baseline = optarg;
+				break;
+
+			case 'G':
+				config.candidate = optarg;
+				break;
+
+			case 'T':
+				config.gate_threshold = get_num("threshold", optarg);
+				break;
+
+			case 'L':
+				config.gate_confidence = get_num("confidence", optarg) / 100.0;
+				break;
+
+			case 'C':
+				config.catalog = optarg;
+				break;
+
+			case 'Q':
+				config.query = optarg;
+				break;
+
+			case 'n':
+				config.daemon = optarg;
+				break;
+
+			case 'M':
+				config.metrics = get_positive("metrics", optarg);
+
+				if (*config.metrics > 65535) {
+					std::cerr << "metrics port must be at most 65535" << std::endl;
+					help(true);
+				}
+				break;
+
+			case 'O': {
+				config.flight = optarg;
+
+				const std::string arg = optarg;
+				const auto colon = arg.find(':');
+				config.flight_threshold = std::chrono::microseconds(get_positive("flight", arg.substr(0, colon).c_str()));
+				if (colon != std::string::npos) {
+					config.flight_dir = arg.substr(colon + 1);
+				}
+				break;
+			}
+
+			case 'X':
+				config.trace = optarg;
+				break;
+
+			case 'K':
+				config.tracefs = true;
+				break;
+
+			case 'y':
+				config.cpu = get_positive("cpu", optarg, true);
+				break;
+
+			case 'Y':
+				config.priority = get_positive("priority", optarg);
+				break;
+
+			case 'j':
+				config.jitter = get_positive("jitter", optarg);
+				break;
+
+			case 'J':
+				config.max_jitter = std::chrono::microseconds(get_positive("max-jitter", optarg));
+				break;
+
+			case 'E': {
+				load_spec spec;
+				spec.text = optarg;
+
+				const auto at = spec.text.find('@');
+				std::vector<std::string> parts;
+				std::istringstream ps(spec.text.substr(0, at));
+				for (std::string part; std::getline(ps, part, ':');) {
+					parts.push_back(part);
+				}
+
+				if (parts.empty() || parts.size() > 3) {
+					std::cerr << "load must be <kind>[:<threads>[:<percent>]][@<cpus>]" << std::endl;
+					help(true);
+				}
+
+				spec.kind = parts[0];
+				if (spec.kind != "cpu" && spec.kind != "mem" && spec.kind != "cache" && spec.kind != "disk" && spec.kind != "irq") {
+					std::cerr << "load kind must be one of cpu, mem, cache, disk, irq" << std::endl;
+					help(true);
+				}
+
+				if (parts.size() > 1) {
+					spec.threads = get_positive("load threads", parts[1].c_str());
+				}
+
+				if (parts.size() > 2) {
+					spec.intensity = std::min(100, get_positive("load percent", parts[2].c_str()));
+				}
+
+				if (at != std::string::npos) {
+					const auto cpus = spec.text.substr(at + 1);
+					const auto dash = cpus.find('-');
+					const int first = get_positive("load cpus", cpus.substr(0, dash).c_str(), true);
+					const int last = dash == std::string::npos ? first : get_positive("load cpus", cpus.substr(dash + 1).c_str(), true);
+					for (int cpu = first; cpu <= last; ++cpu) {
+						spec.cpus.push_back(cpu);
+					}
+				}
+
+				config.load.push_back(spec);
+				break;
+			}
+
+			case 'f':
+				config.feed = std::string("/") + optarg;
+				break;
+
+			case 'l':
+				config.tail = std::string("/") + optarg;
 				break;
 
 			case 's':
@@ -341,34 +6015,411 @@ void parse_args(int argc, char** argv) {
 
 	unsigned int num_cmds = 0;
 	if (config.pin) ++num_cmds;
+	if (config.uinput) ++num_cmds;
 	if (config.usb) ++num_cmds;
 	if (config.events) ++num_cmds;
+	if (config.fit) ++num_cmds;
+	if (config.pack) ++num_cmds;
+	if (config.bench_codec) ++num_cmds;
+	if (!config.analyze.empty()) ++num_cmds;
+	if (config.batch_analyze) ++num_cmds;
+	if (config.baseline || config.candidate) ++num_cmds;
+	if (config.query) ++num_cmds;
+	if (config.daemon) ++num_cmds;
+	if (config.tail) ++num_cmds;
+	if (config.trace) ++num_cmds;
 
 	if (num_cmds == 0) {
-		std::cerr << "Must pass one of: pin, usb, events" << std::endl;
+		std::cerr << "Must pass one of: pin, usb, uinput, events, fit, pack, bench-codec, analyze, batch-analyze, gate, query, daemon, tail, trace" << std::endl;
 		help(true);
 	}
 
 	if (num_cmds > 1) {
-		std::cerr << "Passed conflicting mutually exclusive commands: pin, usb, events" << std::endl;
+		std::cerr << "Passed conflicting mutually exclusive commands: pin, usb, uinput, events, fit, pack, bench-codec, analyze, batch-analyze, gate, query, daemon, tail, trace" << std::endl;
+		help(true);
+	}
+
+#ifdef NO_WIRINGPI
+	if (config.pin || config.usb) {
+		std::cerr << "Built without wiringPi; only the analysis commands are available" << std::endl;
+		exit(1);
+	}
+#endif
+
+	if (!config.baseline != !config.candidate) {
+		std::cerr << "The gate needs both --baseline and --candidate" << std::endl;
+		help(true);
+	}
+
+	if (config.gate_threshold < 0 || config.gate_confidence <= 0 || config.gate_confidence >= 1) {
+		std::cerr << "threshold must be at least 0 and confidence between 0 and 100" << std::endl;
+		help(true);
+	}
+
+	if ((config.usb || config.uinput) && !config.key && !config.keymap) {
+		std::cerr << "Must pass --key or --keymap when using usb or uinput measurement" << std::endl;
 		help(true);
 	}
 
-	if (config.usb && !config.key) {
-		std::cerr << "Must pass --key when using usb measurement" << std::endl;
+	if (config.keymap && !config.usb && !config.uinput) {
+		std::cerr << "--keymap requires usb or uinput measurement" << std::endl;
 		help(true);
 	}
+
+	if (config.keymap) {
+		load_keymap(*config.keymap);
+	} else {
+		config.keys.push_back({g_pin_output, config.key.value_or(0)});
+	}
+
+	if (config.ab) {
+		if (!config.usb || config.keymap || config.sequence || config.pulse || config.idle) {
+			std::cerr << "--ab requires usb measurement with a single --key" << std::endl;
+			help(true);
+		}
+
+		std::vector<int> vals;
+		std::istringstream ps(*config.ab);
+		for (std::string val; std::getline(ps, val, ':');) {
+			vals.push_back(get_num("ab", val.c_str()));
+		}
+
+		if (vals.size() < 2 || vals.size() > 3) {
+			std::cerr << "ab must be <event_id>:<pin>[:<key_code>]" << std::endl;
+			help(true);
+		}
+
+		config.ab_event = vals[0];
+		config.keys.push_back({ vals[1], vals.size() == 3 ? static_cast<unsigned int>(vals[2]) : config.keys[0].code, {}, {}, 1 });
+	}
+
+	if ((config.sequence ? 1 : 0) + (config.pulse ? 1 : 0) + (config.idle ? 1 : 0) > 1) {
+		std::cerr << "Only one of --sequence, --pulse and --idle can be used" << std::endl;
+		help(true);
+	}
+
+	if (config.max_jitter && config.jitter == 0) {
+		std::cerr << "--max-jitter requires --jitter" << std::endl;
+		help(true);
+	}
+
+	if (config.tracefs && (config.sequence || config.pulse || config.idle)) {
+		std::cerr << "--tracefs only works with single-press trials" << std::endl;
+		help(true);
+	}
+
+	if (config.autosuspend && !config.usb) {
+		std::cerr << "--autosuspend requires usb measurement" << std::endl;
+		help(true);
+	}
+
+	if (config.sequence) {
+		parse_sequence(*config.sequence);
+	}
+
+	if (config.flight) {
+		g_flight.emplace();
+	}
+}
+
+void run_command() {
+	if (config.events) {
+		print_event_paths();
+	} else if (config.fit) {
+		print_fit(*config.fit);
+	} else if (config.pack) {
+		print_pack(*config.pack);
+	} else if (config.bench_codec) {
+		print_codec_bench(*config.bench_codec);
+	} else if (!config.analyze.empty()) {
+		print_analysis();
+	} else if (config.batch_analyze) {
+		print_batch_analysis(*config.batch_analyze);
+	} else if (config.baseline) {
+		print_gate(*config.baseline, *config.candidate);
+	} else if (config.query) {
+		print_catalog_query(*config.query);
+	} else if (config.tail) {
+		print_feed(*config.tail);
+	} else if (config.trace) {
+		print_trace(*config.trace);
+	} else if (config.idle) {
+		const auto results = with_detector([](auto poll) { return measure_idle(poll); });
+		print_idle(results);
+
+		// Cataloged as the latency of the first press after each idle time.
+		finish_run([&](int) {
+			std::vector<std::chrono::nanoseconds> times;
+			for (const auto& r : results) {
+				if (r.time) {
+					times.push_back(*r.time);
+				}
+			}
+			return summarize(times);
+		});
+	} else if (config.pulse) {
+		const auto results = with_detector([](auto poll) { return measure_pulse(poll); });
+		print_pulse(results);
+
+		// Cataloged as the widths that were reliably seen, so the minimum
+		// is the threshold.
+		finish_run([&](int) {
+			std::vector<std::chrono::nanoseconds> widths;
+			for (const auto& r : results) {
+				if (r.detected * 2 >= r.reps) {
+					widths.push_back(r.width);
+				}
+			}
+			return summarize(widths);
+		});
+	} else if (config.sequence) {
+		const auto trials = with_detector([](auto poll) { return measure_sequence(poll); });
+		print_sequence(trials);
+
+		// Cataloged as every edge seen, pooled.
+		finish_run([&](int) {
+			std::vector<std::chrono::nanoseconds> times;
+			for (const auto& t : trials) {
+				for (const auto& e : t.edges) {
+					if (e) {
+						times.push_back(*e);
+					}
+				}
+			}
+			return summarize(times);
+		});
+	} else {
+		measure([]() { return with_detector([](auto poll) { return measure_loop(poll); }); });
+	}
+}
+
+void send_line(const int fd, const std::string& line) {
+	const auto msg = line + "\n";
+	send(fd, msg.data(), msg.size(), MSG_NOSIGNAL);
+}
+
+// Splits a request into words at whitespace, like a shell would without
+// expansions: '...' is literal, "..." and a backslash escape the next
+// character. Returns nothing if a quote is left open.
+std::optional<std::vector<std::string>> split_request(const std::string& args) {
+	std::vector<std::string> words;
+	std::string word;
+	bool in_word = false;
+	char quote = 0;
+
+	for (std::size_t i = 0; i < args.size(); ++i) {
+		const char c = args[i];
+
+		if (quote == '\'') {
+			if (c == '\'') {
+				quote = 0;
+			} else {
+				word += c;
+			}
+		} else if (c == '\\' && i + 1 < args.size()) {
+			word += args[++i];
+			in_word = true;
+		} else if (quote == '"') {
+			if (c == '"') {
+				quote = 0;
+			} else {
+				word += c;
+			}
+		} else if (c == '\'' || c == '"') {
+			quote = c;
+			in_word = true;
+		} else if (c == ' ' || c == '\t' || c == '\r') {
+			if (in_word) {
+				words.push_back(word);
+				word.clear();
+				in_word = false;
+			}
+		} else {
+			word += c;
+			in_word = true;
+		}
+	}
+
+	if (quote) {
+		return {};
+	}
+
+	if (in_word) {
+		words.push_back(word);
+	}
+
+	return words;
+}
+
+// Runs one request in a child with its output going to the client. Errors
+// in the request exit the child, not the daemon.
+int run_request(const int client, const std::string& args) {
+	const pid_t pid = fork();
+
+	if (pid == 0) {
+		signal(SIGPIPE, SIG_DFL);
+		dup2(client, STDOUT_FILENO);
+		dup2(client, STDERR_FILENO);
+
+		const auto split = split_request(args);
+		if (!split) {
+			std::cerr << "Unterminated quote in request" << std::endl;
+			exit(1);
+		}
+
+		std::vector<std::string> words { "measure-input-latency" };
+		words.insert(std::end(words), std::begin(*split), std::end(*split));
+
+		std::vector<char*> argv;
+		for (auto& word : words) {
+			argv.push_back(word.data());
+		}
+		argv.push_back(nullptr);
+
+		config = program_config();
+		g_flight.reset();
+		optind = 0;
+		parse_args(words.size(), argv.data());
+
+		if (config.daemon) {
+			std::cerr << "Can't start a daemon from a daemon request" << std::endl;
+			exit(1);
+		}
+
+		g_live_trials = true;
+		run_command();
+		exit(0);
+	}
+
+	if (pid < 0) {
+		return -1;
+	}
+
+	int status = 0;
+	waitpid(pid, &status, 0);
+
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// Accepts requests on a UNIX socket and runs them in order on one worker,
+// so runs never share the rig. Each run is forked from a process that has
+// already set up GPIO, instead of paying for a new process every time.
+void run_daemon(const std::string& path) {
+	signal(SIGPIPE, SIG_IGN);
+	init_pins();
+
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+
+	if (path.size() >= sizeof(addr.sun_path)) {
+		std::cerr << "Socket path too long: " << path << std::endl;
+		exit(1);
+	}
+	std::strcpy(addr.sun_path, path.c_str());
+
+	const int server = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	// Only a socket nobody is listening on any more is ours to replace.
+	struct stat st;
+	if (lstat(path.c_str(), &st) == 0) {
+		const int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		const bool stale = S_ISSOCK(st.st_mode) && probe >= 0 && connect(probe, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 && errno == ECONNREFUSED;
+		if (probe >= 0) {
+			close(probe);
+		}
+
+		if (!stale) {
+			std::cerr << "Could not listen on " << path << ": " << (S_ISSOCK(st.st_mode) ? "still in use" : "not a socket") << std::endl;
+			exit(1);
+		}
+
+		unlink(path.c_str());
+	}
+
+	if (server < 0 || bind(server, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(server, 16) < 0) {
+		std::cerr << "Could not listen on " << path << ": " << std::strerror(errno) << std::endl;
+		exit(1);
+	}
+
+	struct request {
+		int fd;
+		std::string args;
+	};
+
+	std::mutex mutex;
+	std::condition_variable ready;
+	std::deque<request> queue;
+	std::optional<std::string> running;
+
+	std::thread worker([&]() {
+		for (;;) {
+			request r;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				ready.wait(lock, [&]() { return !queue.empty(); });
+				r = queue.front();
+				queue.pop_front();
+				running = r.args;
+			}
+
+			const auto status = run_request(r.fd, r.args);
+			send_line(r.fd, "{\"exit\":" + std::to_string(status) + "}");
+			close(r.fd);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			running.reset();
+		}
+	});
+
+	for (;;) {
+		const int client = accept4(server, nullptr, nullptr, SOCK_CLOEXEC);
+
+		if (client < 0) {
+			continue;
+		}
+
+		// A client that connects and says nothing mustn't hold up the others.
+		const timeval timeout = { 1, 0 };
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+		std::string line;
+		char c;
+		while (line.size() < 4096 && read(client, &c, 1) == 1 && c != '\n') {
+			line += c;
+		}
+
+		std::unique_lock<std::mutex> lock(mutex);
+
+		if (line == "status") {
+			std::string queued;
+			for (const auto& r : queue) {
+				queued += (queued.empty() ? "" : ",") + json_string(r.args);
+			}
+
+			const auto status = "{\"running\":" + (running ? json_string(*running) : "null") + ",\"queued\":[" + queued + "]}";
+			lock.unlock();
+
+			send_line(client, status);
+			close(client);
+			continue;
+		}
+
+		send_line(client, "{\"queued\":" + std::to_string(queue.size() + (running ? 1 : 0)) + "}");
+		queue.push_back({ client, line });
+		lock.unlock();
+		ready.notify_one();
+	}
+
+	worker.join();
 }
 
 int main(int argc, char* argv[]) {
 	parse_args(argc, argv);
 
-	if (config.events) {
-		print_event_paths();
-	} else if (config.pin) {
-		measure([]() { return measure_pin(); });
-	} else if (config.usb) {
-		measure([]() { return measure_usb(*config.usb); });
+	if (config.daemon) {
+		run_daemon(*config.daemon);
+	} else {
+		run_command();
 	}
 
 	return 0;